@@ -0,0 +1,517 @@
+/*
+ * encoding_benchmark.cpp - micro benchmarks of the record decoding routines
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "civil_time.h"
+#include "string_encoding_utils.h"
+#include "text_escape.h"
+#include "varint.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <codecvt>
+#include <cstdio>
+#include <cstring>
+#include <locale>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+namespace {
+
+// the byte at a time conversion the library used before, for comparison
+std::string reference_iso8859_to_utf8(const uint8_t *data, size_t length)
+{
+	static const uint16_t cp1252[32] = {
+		0x20ac, 0x0000, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+		0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017d, 0x0000,
+		0x0000, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+		0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x0000, 0x017e, 0x0178
+	};
+
+	std::string result;
+	for (size_t i = 0; i != length; ++i) {
+		uint32_t uc = data[i];
+		if (uc >= 0x80 && uc < 0xa0) {
+			uc = cp1252[uc - 0x80];
+		}
+		if (uc < 0x80) {
+			result.append(1u, static_cast<char>(uc));
+		} else if (uc < 0x800) {
+			result.append(1u, static_cast<char>(0xC0 | (uc >> 6)));
+			result.append(1u, static_cast<char>(0x80 | (uc & 0x3F)));
+		} else {
+			result.append(1u, static_cast<char>(0xE0 | (uc >> 12)));
+			result.append(1u, static_cast<char>(0x80 | ((uc >> 6) & 0x3F)));
+			result.append(1u, static_cast<char>(0x80 | (uc & 0x3F)));
+		}
+	}
+	return result;
+}
+
+// message like text: mostly ASCII with some accented letters and now and
+// then a Windows-1252 punctuation character
+std::vector<uint8_t> make_text(size_t size, unsigned highPercent,
+							   unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<uint8_t> text(size);
+	for (auto &c : text) {
+		if (rng() % 100 < highPercent) {
+			if (rng() % 20 == 0) {
+				c = static_cast<uint8_t>(0x80 + rng() % 0x20);
+			} else {
+				c = static_cast<uint8_t>(0xa0 + rng() % 0x60);
+			}
+		} else {
+			c = static_cast<uint8_t>(0x20 + rng() % 0x5f);
+		}
+	}
+	return text;
+}
+
+// what StringRef::str() used before, valid UTF-16 only
+std::string reference_utf16le_to_utf8(const uint8_t *data, size_t length)
+{
+	std::u16string units(length / 2, u'\0');
+	memcpy(&units[0], data, units.size() * 2);
+	return std::wstring_convert<
+			std::codecvt_utf8_utf16<char16_t>, char16_t>().to_bytes(units);
+}
+
+// UTF-16LE text, mostly ASCII with Cyrillic, CJK and emoji mixed in
+std::vector<uint8_t> make_utf16_text(size_t units, unsigned nonAsciiPercent,
+									 unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<uint8_t> text;
+	auto append = [&text](uint16_t u) {
+		text.push_back(static_cast<uint8_t>(u));
+		text.push_back(static_cast<uint8_t>(u >> 8));
+	};
+	while (text.size() < 2 * units) {
+		if (rng() % 100 >= nonAsciiPercent) {
+			append(static_cast<uint16_t>(0x20 + rng() % 0x5f));
+			continue;
+		}
+		switch (rng() % 4) {
+		case 0:
+		case 1:
+			append(static_cast<uint16_t>(0x410 + rng() % 0x40));
+			break;
+		case 2:
+			append(static_cast<uint16_t>(0x4e00 + rng() % 0x5000));
+			break;
+		default:
+			const uint32_t uc = 0x1f600 + rng() % 0x50 - 0x10000;
+			append(static_cast<uint16_t>(0xd800 + (uc >> 10)));
+			append(static_cast<uint16_t>(0xdc00 + (uc & 0x3ff)));
+			break;
+		}
+	}
+	return text;
+}
+
+// the varint decoder the parsers used before
+size_t reference_parse_varint(const uint8_t **p, const uint8_t *const pend)
+{
+	const uint8_t *i = *p;
+	if ((*i & 0x80) == 0) {
+		(*p)++;
+		return *i;
+	}
+
+	int count = 0;
+	uint8_t buf[8] = {};
+	while (*i & 0x80 && i != pend && count < (int) sizeof(buf)) {
+		buf[count++] = *i & 0x7fu;
+		i++;
+	}
+
+	buf[count++] = *i & 0x7fu;
+	i++;
+
+	size_t res = 0;
+	assert(count > 0);
+	for (; count >= 0; count--) {
+		res <<= 7;
+		res |= buf[count];
+	}
+	*p = i;
+	return res;
+}
+
+void append_varint(std::vector<uint8_t> &out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+// varints of up to maxBits significant bits, the small ones more frequent
+std::vector<uint8_t> make_varints(size_t count, unsigned maxBits,
+								  unsigned seed, std::vector<uint64_t> *values)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<uint8_t> out;
+	for (size_t i = 0; i < count; ++i) {
+		const unsigned bits = 1 + rng() % maxBits;
+		const uint64_t value = rng() & (~0ull >> (64 - bits));
+		append_varint(out, value);
+		if (values) {
+			values->push_back(value);
+		}
+	}
+	return out;
+}
+
+// the gmtime_r() and snprintf() formatting the message times used before
+size_t reference_format_timestamp(int64_t ms, char *out)
+{
+	const time_t t = (time_t) std::floor((double) ms / 1000);
+	struct tm parts = {};
+	gmtime_r(&t, &parts);
+	return (size_t) snprintf(out, civil::TimestampFormatter::maxLength,
+							 "%04d-%02d-%02dT%02d-%02d-%02dZ",
+							 parts.tm_year + 1900, parts.tm_mon + 1,
+							 parts.tm_mday, parts.tm_hour, parts.tm_min,
+							 parts.tm_sec);
+}
+
+// message times, sorted like the messages of a conversation, a few seconds
+// to a few hours apart
+std::vector<int64_t> make_timestamps(size_t count, unsigned seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<int64_t> times;
+	int64_t ms = 1600000000000;
+	for (size_t i = 0; i < count; ++i) {
+		ms += (int64_t) (rng() % (rng() % 4 == 0 ? 10800000 : 60000));
+		times.push_back(ms);
+	}
+	return times;
+}
+
+template <class Function>
+double timestamps_per_us(const std::vector<int64_t> &times, Function format)
+{
+	const int rounds = 200;
+	size_t sink = 0;
+	char buffer[civil::TimestampFormatter::maxLength];
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i) {
+		for (int64_t ms : times) {
+			sink += format(ms, buffer);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+	const double us =
+			std::chrono::duration<double, std::micro>(end - start).count();
+	return sink ? (double) times.size() * rounds / us : 0;
+}
+
+// the CSV quoting the scanner used before, an insert() for every quote
+std::string &reference_csv_field(std::string &val)
+{
+	auto pos = val.find_first_of(",\"\n\r");
+	if (pos == std::string::npos) {
+		return val;
+	}
+
+	val.insert(0, 1, '"');
+	pos++;
+	if (val[pos] == '"') {
+		val.insert(pos, 1, '"');
+		pos += 2;
+	}
+	while (true) {
+		pos = val.find('"', pos);
+		if (pos != std::string::npos) {
+			val.insert(pos, 1, '"');
+			pos += 2;
+		} else {
+			break;
+		}
+	}
+	val += '"';
+	return val;
+}
+
+// pasted text with a quote, a comma or a line break every `spacing`
+// characters on average
+std::string make_csv_text(size_t size, unsigned spacing, unsigned seed)
+{
+	static const char specials[] = "\"\",\n\r";
+	std::mt19937 rng(seed);
+	std::string text(size, ' ');
+	for (auto &c : text) {
+		c = rng() % spacing == 0 ? specials[rng() % 5] :
+				static_cast<char>(0x20 + rng() % 0x5f);
+	}
+	return text;
+}
+
+template <class Function>
+double bytes_per_ns(const std::vector<uint8_t> &text, Function convert)
+{
+	const int rounds = 200;
+	size_t sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i) {
+		sink += convert(text.data(), text.size()).size();
+	}
+	const auto end = std::chrono::steady_clock::now();
+	const double ns =
+			std::chrono::duration<double, std::nano>(end - start).count();
+	return sink ? (double) text.size() * rounds / ns : 0;
+}
+
+template <class Function>
+double varints_per_us(const std::vector<uint8_t> &data, size_t count,
+					  Function decode)
+{
+	const int rounds = 200;
+	uint64_t sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i) {
+		const uint8_t *p = data.data();
+		const uint8_t *const pend = p + data.size();
+		while (p != pend) {
+			sink += decode(&p, pend);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+	const double us =
+			std::chrono::duration<double, std::micro>(end - start).count();
+	return sink ? (double) count * rounds / us : 0;
+}
+
+bool verify()
+{
+	for (unsigned seed = 0; seed < 2000; ++seed) {
+		const auto text = make_text(seed % 300, seed % 101, seed);
+		if (cp::convert_iso8859_to_utf8(text.data(), text.size()) !=
+			reference_iso8859_to_utf8(text.data(), text.size())) {
+			fprintf(stderr, "mismatch for seed %u\n", seed);
+			return false;
+		}
+	}
+
+	for (unsigned seed = 0; seed < 2000; ++seed) {
+		// start at an odd address, the strings aren't aligned in the records
+		auto text = make_utf16_text(seed % 300, seed % 101, seed);
+		text.insert(text.begin(), 0);
+		if (cp::convert_utf16le_to_utf8(text.data() + 1, text.size() - 1) !=
+			reference_utf16le_to_utf8(text.data() + 1, text.size() - 1)) {
+			fprintf(stderr, "UTF-16 mismatch for seed %u\n", seed);
+			return false;
+		}
+	}
+
+	for (unsigned seed = 0; seed < 200; ++seed) {
+		std::vector<uint64_t> values;
+		const auto data = make_varints(500, 64, seed, &values);
+		const uint8_t *p = data.data();
+		const uint8_t *const pend = p + data.size();
+		for (uint64_t expected : values) {
+			uint64_t value;
+			if (!varint::decode(&p, pend, &value) || value != expected) {
+				fprintf(stderr, "varint mismatch for seed %u\n", seed);
+				return false;
+			}
+		}
+		// every proper prefix of the last varint is truncated
+		const uint8_t *last = pend - 1;
+		while (last > data.data() && (last[-1] & 0x80)) {
+			--last;
+		}
+		for (const uint8_t *end = last; end < pend; ++end) {
+			const uint8_t *q = last;
+			uint64_t value;
+			if (varint::decode(&q, end, &value)) {
+				fprintf(stderr, "truncated varint decoded\n");
+				return false;
+			}
+		}
+	}
+
+	// unpaired surrogates and a truncated code unit
+	static const struct
+	{
+		const char *utf16le;
+		size_t length;
+		const char *utf8;
+	} invalid[] = {
+		{"a\0\x00\xd8", 4, "a\xef\xbf\xbd"},
+		{"\x00\xdc" "b\0", 4, "\xef\xbf\xbd" "b"},
+		{"\x00\xd8\x00\xd8\x00\xdc", 6, "\xef\xbf\xbd\xf0\x90\x80\x80"},
+		{"a\0b", 3, "a\xef\xbf\xbd"},
+	};
+	for (const auto &test : invalid) {
+		if (cp::convert_utf16le_to_utf8(
+					reinterpret_cast<const uint8_t *>(test.utf16le),
+					test.length) != test.utf8) {
+			fprintf(stderr, "invalid UTF-16 not replaced\n");
+			return false;
+		}
+	}
+
+	for (unsigned seed = 0; seed < 2000; ++seed) {
+		std::string text = make_csv_text(seed % 300, 1 + seed % 40, seed);
+		output::OutputBuffer out;
+		escape::append_csv_field(out, text);
+		if (out.view() != reference_csv_field(text)) {
+			fprintf(stderr, "CSV mismatch for seed %u\n", seed);
+			return false;
+		}
+	}
+
+	// the escapes of base::EscapeJSONString(), the replaced UTF-8
+	static const struct
+	{
+		const char *text;
+		const char *json;
+	} jsonStrings[] = {
+		{"a\"b\\c/", "\"a\\\"b\\\\c/\""},
+		{"<\b\f\n\r\t\x01\x1f\x7f",
+		 "\"\\u003C\\b\\f\\n\\r\\t\\u0001\\u001F\x7f\""},
+		{"\xe2\x80\xa8\xe2\x80\xa9\xc3\xa9", "\"\\u2028\\u2029\xc3\xa9\""},
+		{"\xef\xbf\xbe\xed\xa0\x80\xc3",
+		 "\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"
+		 "\xef\xbf\xbd\""},
+	};
+	for (const auto &test : jsonStrings) {
+		output::OutputBuffer out;
+		escape::append_json_string(out, test.text);
+		if (out.view() != test.json) {
+			fprintf(stderr, "JSON mismatch for %s\n", test.json);
+			return false;
+		}
+	}
+
+	// random times from the year -271820 to 275759, and around the epoch
+	std::mt19937_64 rng(42);
+	civil::TimestampFormatter formatter;
+	for (int i = 0; i < 200000; ++i) {
+		const int64_t range = i % 2 ? 8640000000000000 : 10000000000000;
+		const int64_t ms = (int64_t) (rng() % (2 * (uint64_t) range)) - range;
+		char expected[civil::TimestampFormatter::maxLength];
+		char actual[civil::TimestampFormatter::maxLength];
+		const size_t n = reference_format_timestamp(ms, expected);
+		if (formatter.format(ms, actual) != n ||
+			memcmp(actual, expected, n) != 0) {
+			fprintf(stderr, "timestamp mismatch for %lld\n", (long long) ms);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main()
+{
+	if (!verify()) {
+		return 1;
+	}
+
+	printf("%-28s %12s %12s %8s\n", "ISO-8859-1 -> UTF-8", "before GB/s",
+		   "after GB/s", "speedup");
+	for (unsigned highPercent : {0, 1, 10, 50}) {
+		const auto text = make_text(64 * 1024, highPercent, 42);
+		const double before = bytes_per_ns(text, reference_iso8859_to_utf8);
+		const double after = bytes_per_ns(text, cp::convert_iso8859_to_utf8);
+		char name[32];
+		snprintf(name, sizeof(name), "%u%% high bytes", highPercent);
+		printf("%-28s %12.2f %12.2f %7.1fx\n", name, before, after,
+			   after / before);
+	}
+
+	printf("%-28s %12s %12s %8s\n", "UTF-16LE -> UTF-8", "before GB/s",
+		   "after GB/s", "speedup");
+	for (unsigned nonAsciiPercent : {0, 10, 50, 100}) {
+		const auto text = make_utf16_text(32 * 1024, nonAsciiPercent, 42);
+		const double before = bytes_per_ns(text, reference_utf16le_to_utf8);
+		const double after = bytes_per_ns(text, cp::convert_utf16le_to_utf8);
+		char name[32];
+		snprintf(name, sizeof(name), "%u%% non-ASCII", nonAsciiPercent);
+		printf("%-28s %12.2f %12.2f %7.1fx\n", name, before, after,
+			   after / before);
+	}
+
+	printf("%-28s %12s %12s %8s\n", "varint", "before M/s", "after M/s",
+		   "speedup");
+	for (unsigned maxBits : {7, 14, 35}) {
+		const size_t count = 64 * 1024;
+		const auto data = make_varints(count, maxBits, 42, nullptr);
+		const double before = varints_per_us(data, count,
+				[](const uint8_t **p, const uint8_t *pend) {
+					return (uint64_t) reference_parse_varint(p, pend);
+				});
+		const double after = varints_per_us(data, count,
+				[](const uint8_t **p, const uint8_t *pend) {
+					uint64_t value = 0;
+					varint::decode(p, pend, &value);
+					return value;
+				});
+		char name[32];
+		snprintf(name, sizeof(name), "up to %u bits", maxBits);
+		printf("%-28s %12.0f %12.0f %7.1fx\n", name, before, after,
+			   after / before);
+	}
+
+	printf("%-28s %12s %12s %8s\n", "CSV field", "before GB/s",
+		   "after GB/s", "speedup");
+	for (size_t size : {(size_t) 100, (size_t) 4 << 20}) {
+		const std::string text = make_csv_text(size, 50, 42);
+		const int rounds = size < 1000 ? 200000 : 2;
+		output::OutputBuffer out;
+		auto measure = [&](auto escape) {
+			const auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < rounds; ++i) {
+				out.clear();
+				escape(text);
+			}
+			const auto end = std::chrono::steady_clock::now();
+			return (double) size * rounds /
+					std::chrono::duration<double, std::nano>(end - start)
+							.count();
+		};
+		const double before = measure([&out](const std::string &text) {
+			std::string value = text;
+			out << reference_csv_field(value);
+		});
+		const double after = measure([&out](const std::string &text) {
+			escape::append_csv_field(out, text);
+		});
+		char name[32];
+		snprintf(name, sizeof(name), "%zu bytes, 2%% special", size);
+		printf("%-28s %12.2f %12.2f %7.1fx\n", name, before, after,
+			   after / before);
+	}
+
+	printf("%-28s %12s %12s %8s\n", "timestamp", "before M/s", "after M/s",
+		   "speedup");
+	{
+		const auto times = make_timestamps(64 * 1024, 42);
+		const double before = timestamps_per_us(times,
+												reference_format_timestamp);
+		civil::TimestampFormatter formatter;
+		const double after = timestamps_per_us(times,
+				[&formatter](int64_t ms, char *out) {
+					return formatter.format(ms, out);
+				});
+		printf("%-28s %12.0f %12.0f %7.1fx\n", "sorted message times", before,
+			   after, after / before);
+	}
+	return 0;
+}
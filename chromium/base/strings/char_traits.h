@@ -66,10 +66,11 @@ constexpr int CharTraits<char>::compare(const char* s1,
 #if HAS_FEATURE(cxx_constexpr_string_builtins)
   return __builtin_memcmp(s1, s2, n);
 #else
+  // Compare as unsigned char, like memcmp() and std::char_traits<char>.
   for (; n; --n, ++s1, ++s2) {
-    if (*s1 < *s2)
+    if (static_cast<unsigned char>(*s1) < static_cast<unsigned char>(*s2))
       return -1;
-    if (*s1 > *s2)
+    if (static_cast<unsigned char>(*s1) > static_cast<unsigned char>(*s2))
       return 1;
   }
   return 0;
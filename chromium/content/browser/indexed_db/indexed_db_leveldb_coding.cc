@@ -15,6 +15,7 @@
 #include "base/strings/utf_string_conversions.h"
 #include "base/sys_byteorder.h"
 #include "build/build_config.h"
+#include "varint.h"
 
 // See leveldb_coding_scheme.md for detailed documentation of the coding
 // scheme implemented here.
@@ -295,22 +296,13 @@ bool DecodeInt(StringPiece* slice, int64_t* value) {
 }
 
 bool DecodeVarInt(StringPiece* slice, int64_t* value) {
-  if (slice->empty())
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(slice->data());
+  const uint8_t* p = begin;
+  uint64_t result;
+  if (!varint::decode(&p, begin + slice->size(), &result))
     return false;
-
-  StringPiece::const_iterator it = slice->begin();
-  int shift = 0;
-  int64_t ret = 0;
-  do {
-    if (it == slice->end())
-      return false;
-
-    unsigned char c = *it;
-    ret |= static_cast<int64_t>(c & 0x7f) << shift;
-    shift += 7;
-  } while (*it++ & 0x80);
-  *value = ret;
-  slice->remove_prefix(it - slice->begin());
+  *value = static_cast<int64_t>(result);
+  slice->remove_prefix(p - begin);
   return true;
 }
 
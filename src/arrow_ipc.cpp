@@ -0,0 +1,362 @@
+/*
+ * arrow_ipc.cpp - write record batches in the Apache Arrow IPC stream format
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "arrow_ipc.h"
+
+#include <cstring>
+
+namespace arrow_ipc {
+
+namespace {
+
+// the values of the Arrow format/*.fbs enums and unions used here
+const int16_t metadataVersionV5 = 4;
+const uint8_t messageHeaderSchema = 1;
+const uint8_t messageHeaderRecordBatch = 3;
+const uint8_t typeUtf8 = 5;
+const uint8_t typeTimestamp = 10;
+const int16_t timeUnitMillisecond = 1;
+
+const uint32_t continuationMarker = 0xffffffff;
+
+// The body buffers and the messages are aligned to 8 bytes, the readers
+// expect it for the 64 bit values.
+const size_t alignment = 8;
+
+size_t padding(size_t size)
+{
+	return (alignment - size % alignment) % alignment;
+}
+
+// A FlatBuffer built back to front, like the FlatBufferBuilder of the
+// flatbuffers library does: the children before their parents, so that
+// the offsets, which point forward, are known when the parents are written.
+// An object is referred to by its distance from the end of the buffer. The
+// messages are small, the bytes are prepended to a vector.
+class FlatBuilder
+{
+public:
+	using Ref = uint32_t;
+
+	size_t size() const { return bytes_.size(); }
+
+	template <class T>
+	void prepend(T value)
+	{
+		align(sizeof(T), 0);
+		prependBytes(&value, sizeof(T));
+	}
+
+	void prependOffset(Ref ref)
+	{
+		align(4, 0);
+		prependBytes(nullptr, 4);
+		const uint32_t offset = (uint32_t) size() - ref;
+		memcpy(bytes_.data(), &offset, 4);
+	}
+
+	Ref createString(std::string_view s)
+	{
+		align(4, s.size() + 1);
+		prependBytes(nullptr, 1);
+		prependBytes(s.data(), s.size());
+		prependLength(s.size());
+		return (Ref) size();
+	}
+
+	Ref createOffsetVector(const std::vector<Ref> &refs)
+	{
+		align(4, 4 * refs.size());
+		for (size_t i = refs.size(); i-- > 0;) {
+			prependOffset(refs[i]);
+		}
+		prependLength(refs.size());
+		return (Ref) size();
+	}
+
+	// a vector of the structs of two longs, Arrow's FieldNode and Buffer
+	Ref createPairVector(const std::vector<std::pair<int64_t, int64_t>> &pairs)
+	{
+		align(4, 16 * pairs.size());
+		align(8, 16 * pairs.size());
+		for (size_t i = pairs.size(); i-- > 0;) {
+			prependBytes(&pairs[i].second, 8);
+			prependBytes(&pairs[i].first, 8);
+		}
+		prependLength(pairs.size());
+		return (Ref) size();
+	}
+
+	void startTable()
+	{
+		tableStart_ = size();
+		fields_.clear();
+	}
+
+	template <class T>
+	void addField(unsigned id, T value)
+	{
+		prepend(value);
+		setField(id);
+	}
+
+	void addOffsetField(unsigned id, Ref ref)
+	{
+		prependOffset(ref);
+		setField(id);
+	}
+
+	// write the table and its vtable
+	Ref endTable()
+	{
+		prepend<int32_t>(0);
+		const Ref table = (Ref) size();
+		std::vector<uint16_t> vtable(2 + fields_.size());
+		vtable[0] = (uint16_t) (2 * vtable.size());
+		vtable[1] = (uint16_t) (table - tableStart_);
+		for (size_t id = 0; id < fields_.size(); ++id) {
+			vtable[2 + id] = fields_[id] ? (uint16_t) (table - fields_[id]) : 0;
+		}
+		for (size_t i = vtable.size(); i-- > 0;) {
+			prependBytes(&vtable[i], 2);
+		}
+		// from the table back to its vtable
+		const int32_t vtableOffset = (int32_t) (size() - table);
+		memcpy(bytes_.data() + size() - table, &vtableOffset, 4);
+		return table;
+	}
+
+	// the finished buffer, with the offset of the root table at the start
+	const std::vector<uint8_t> &finish(Ref root)
+	{
+		align(alignment, 4);
+		prependOffset(root);
+		return bytes_;
+	}
+
+private:
+	// pad so that the object of `size` bytes prepended next ends aligned
+	void align(size_t n, size_t size)
+	{
+		const size_t pad = (n - (this->size() + size) % n) % n;
+		bytes_.insert(bytes_.begin(), pad, 0);
+	}
+
+	void prependBytes(const void *data, size_t size)
+	{
+		bytes_.insert(bytes_.begin(), size, 0);
+		if (data) {
+			memcpy(bytes_.data(), data, size);
+		}
+	}
+
+	void prependLength(size_t length)
+	{
+		const uint32_t value = (uint32_t) length;
+		prependBytes(&value, 4);
+	}
+
+	void setField(unsigned id)
+	{
+		if (fields_.size() <= id) {
+			fields_.resize(id + 1);
+		}
+		fields_[id] = (Ref) size();
+	}
+
+	std::vector<uint8_t> bytes_;
+	size_t tableStart_ = 0;
+	std::vector<Ref> fields_; // where the fields of the current table are
+};
+
+// the Message table around a header, see Message.fbs
+void write_message(output::OutputBuffer &out, FlatBuilder &builder,
+				   uint8_t headerType, FlatBuilder::Ref header,
+				   int64_t bodyLength)
+{
+	builder.startTable();
+	builder.addField<int64_t>(3, bodyLength);
+	builder.addOffsetField(2, header);
+	builder.addField<int16_t>(0, metadataVersionV5);
+	builder.addField<uint8_t>(1, headerType);
+	const std::vector<uint8_t> &message = builder.finish(builder.endTable());
+
+	// the size of the metadata includes the padding up to the body
+	const uint32_t size = (uint32_t) (message.size() + padding(message.size()));
+	out.append(reinterpret_cast<const char *>(&continuationMarker), 4);
+	out.append(reinterpret_cast<const char *>(&size), 4);
+	out.append(reinterpret_cast<const char *>(message.data()), message.size());
+	out.append("\0\0\0\0\0\0\0", padding(message.size()));
+}
+
+} // namespace
+
+void write_schema(output::OutputBuffer &out, const std::vector<Column> &columns)
+{
+	FlatBuilder builder;
+	std::vector<FlatBuilder::Ref> fields;
+	for (const Column &column : columns) {
+		FlatBuilder::Ref type;
+		uint8_t typeType;
+		if (column.type == ColumnType::Utf8) {
+			builder.startTable();
+			type = builder.endTable();
+			typeType = typeUtf8;
+		} else {
+			const FlatBuilder::Ref timezone = builder.createString("UTC");
+			builder.startTable();
+			builder.addOffsetField(1, timezone);
+			builder.addField<int16_t>(0, timeUnitMillisecond);
+			type = builder.endTable();
+			typeType = typeTimestamp;
+		}
+		// the readers expect the children, even when there are none
+		const FlatBuilder::Ref children = builder.createOffsetVector({});
+		const FlatBuilder::Ref name = builder.createString(column.name);
+
+		builder.startTable();
+		builder.addOffsetField(0, name);
+		builder.addOffsetField(3, type);
+		builder.addOffsetField(5, children);
+		builder.addField<uint8_t>(1, 1); // nullable
+		builder.addField<uint8_t>(2, typeType);
+		fields.push_back(builder.endTable());
+	}
+	const FlatBuilder::Ref fieldVector = builder.createOffsetVector(fields);
+
+	builder.startTable();
+	builder.addOffsetField(1, fieldVector);
+	builder.addField<int16_t>(0, 0); // little endian
+	write_message(out, builder, messageHeaderSchema, builder.endTable(), 0);
+}
+
+void write_end_of_stream(output::OutputBuffer &out)
+{
+	const uint32_t marker[2] = {continuationMarker, 0};
+	out.append(reinterpret_cast<const char *>(marker), sizeof(marker));
+}
+
+RecordBatchBuilder::RecordBatchBuilder(const std::vector<Column> &columns)
+{
+	for (const Column &column : columns) {
+		columns_.emplace_back();
+		columns_.back().type = column.type;
+		if (column.type == ColumnType::Utf8) {
+			columns_.back().offsets.push_back(0);
+		}
+	}
+}
+
+void RecordBatchBuilder::appendValidity(ColumnData &column, bool valid)
+{
+	const size_t row = column.type == ColumnType::Utf8 ?
+			column.offsets.size() - 1 : column.values.size();
+	if (row % 8 == 0) {
+		column.validity.push_back(0);
+	}
+	if (valid) {
+		column.validity.back() |= (uint8_t) (1u << row % 8);
+	} else {
+		column.nullCount++;
+	}
+}
+
+void RecordBatchBuilder::appendString(size_t column, std::string_view value)
+{
+	ColumnData &c = columns_[column];
+	appendValidity(c, true);
+	c.data.append(value.data(), value.size());
+	c.offsets.push_back((int32_t) c.data.size());
+	bytes_ += value.size() + 4;
+}
+
+void RecordBatchBuilder::appendTimestamp(size_t column, int64_t ms)
+{
+	ColumnData &c = columns_[column];
+	appendValidity(c, true);
+	c.values.push_back(ms);
+	bytes_ += 8;
+}
+
+void RecordBatchBuilder::appendNull(size_t column)
+{
+	ColumnData &c = columns_[column];
+	appendValidity(c, false);
+	if (c.type == ColumnType::Utf8) {
+		c.offsets.push_back((int32_t) c.data.size());
+		bytes_ += 4;
+	} else {
+		c.values.push_back(0);
+		bytes_ += 8;
+	}
+}
+
+void RecordBatchBuilder::write(output::OutputBuffer &out)
+{
+	if (rows_ == 0) {
+		return;
+	}
+
+	// the buffers of the columns in the order of the layouts of their
+	// types: the validity bitmap, then the offsets and the characters of
+	// the strings, or the values
+	struct Piece
+	{
+		const void *data;
+		size_t size;
+	};
+	std::vector<Piece> pieces;
+	std::vector<std::pair<int64_t, int64_t>> nodes;
+	std::vector<std::pair<int64_t, int64_t>> buffers;
+	int64_t bodyLength = 0;
+	auto addBuffer = [&](const void *data, size_t size) {
+		pieces.push_back({data, size});
+		buffers.emplace_back(bodyLength, (int64_t) size);
+		bodyLength += (int64_t) (size + padding(size));
+	};
+	for (const ColumnData &c : columns_) {
+		nodes.emplace_back((int64_t) rows_, (int64_t) c.nullCount);
+		// without nulls the bitmap can be left out
+		addBuffer(c.validity.data(), c.nullCount != 0 ? c.validity.size() : 0);
+		if (c.type == ColumnType::Utf8) {
+			addBuffer(c.offsets.data(), 4 * c.offsets.size());
+			addBuffer(c.data.data(), c.data.size());
+		} else {
+			addBuffer(c.values.data(), 8 * c.values.size());
+		}
+	}
+
+	FlatBuilder builder;
+	const FlatBuilder::Ref bufferVector = builder.createPairVector(buffers);
+	const FlatBuilder::Ref nodeVector = builder.createPairVector(nodes);
+	builder.startTable();
+	builder.addField<int64_t>(0, (int64_t) rows_);
+	builder.addOffsetField(1, nodeVector);
+	builder.addOffsetField(2, bufferVector);
+	write_message(out, builder, messageHeaderRecordBatch, builder.endTable(),
+				  bodyLength);
+
+	for (const Piece &piece : pieces) {
+		out.append(static_cast<const char *>(piece.data), piece.size);
+		out.append("\0\0\0\0\0\0\0", padding(piece.size));
+	}
+
+	for (ColumnData &c : columns_) {
+		c.validity.clear();
+		c.nullCount = 0;
+		c.data.clear();
+		c.values.clear();
+		if (c.type == ColumnType::Utf8) {
+			c.offsets.assign(1, 0);
+		}
+	}
+	rows_ = 0;
+	bytes_ = 0;
+}
+
+} /* namespace arrow_ipc */
@@ -0,0 +1,96 @@
+/*
+ * arrow_ipc.h - write record batches in the Apache Arrow IPC stream format
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_ARROW_IPC_H_
+#define SRC_ARROW_IPC_H_
+
+#include "output_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The Arrow columnar format, https://arrow.apache.org/docs/format/, written
+// without the Arrow libraries: a stream is a Schema message, RecordBatch
+// messages and an end of stream marker. The messages are FlatBuffers built
+// by hand, the body of a batch holds the column buffers as they are used in
+// memory, so that the readers can map the file and use them without
+// parsing. Only the nullable UTF-8 and timestamp columns are supported.
+namespace arrow_ipc {
+
+enum class ColumnType {
+	Utf8,
+	TimestampMs // milliseconds since the epoch, UTC
+};
+
+struct Column
+{
+	std::string_view name;
+	ColumnType type;
+};
+
+// the Schema message which starts a stream
+void write_schema(output::OutputBuffer &out, const std::vector<Column> &columns);
+
+// the end of stream marker
+void write_end_of_stream(output::OutputBuffer &out);
+
+// The values of a record batch, column by column. Each row must be given a
+// value, or a null, in every column before the batch is written.
+class RecordBatchBuilder
+{
+public:
+	// Batches are written when they reach this many rows, or this many
+	// bytes, which keeps the 32 bit offsets of the strings in range.
+	static constexpr size_t maxRows = 64 * 1024;
+	static constexpr size_t maxBytes = 64 << 20;
+
+	explicit RecordBatchBuilder(const std::vector<Column> &columns);
+
+	void appendString(size_t column, std::string_view value);
+	void appendTimestamp(size_t column, int64_t ms);
+	void appendNull(size_t column);
+
+	size_t rows() const { return rows_; }
+	size_t bytes() const { return bytes_; }
+
+	// count a row whose columns have all been appended, true when the batch
+	// should be written
+	bool endRow()
+	{
+		rows_++;
+		return rows_ >= maxRows || bytes_ >= maxBytes;
+	}
+
+	// Write the rows as a RecordBatch message, then start the next batch.
+	// Nothing is written when there are no rows.
+	void write(output::OutputBuffer &out);
+
+private:
+	struct ColumnData
+	{
+		ColumnType type;
+		std::vector<uint8_t> validity; // a bit per row, set when not null
+		size_t nullCount = 0;
+		std::vector<int32_t> offsets;  // of the strings in `data`
+		std::string data;
+		std::vector<int64_t> values;   // the timestamps
+	};
+
+	void appendValidity(ColumnData &column, bool valid);
+
+	std::vector<ColumnData> columns_;
+	size_t rows_ = 0;
+	size_t bytes_ = 0;
+};
+
+} /* namespace arrow_ipc */
+
+#endif /* SRC_ARROW_IPC_H_ */
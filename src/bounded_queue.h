@@ -0,0 +1,181 @@
+/*
+ * bounded_queue.h - bounded lock-free multi-producer multi-consumer queue
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_BOUNDED_QUEUE_H_
+#define SRC_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace lockfree {
+
+// Puts a thread to sleep until a condition on some lock-free state holds.
+// The thread changing the state calls notify(), which only takes the mutex
+// when a thread is waiting, so the fast paths stay free of locks.
+class Signal
+{
+public:
+	template <class Predicate>
+	void wait(Predicate ready)
+	{
+		if (ready()) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		waiters_.fetch_add(1, std::memory_order_relaxed);
+		// either ready() sees the change or notify() sees the waiter
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		condition_.wait(lock, ready);
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_relaxed) != 0) {
+			// a waiter holds the mutex until it sleeps
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+			}
+			condition_.notify_all();
+		}
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::atomic<unsigned> waiters_ {0};
+};
+
+// Ring buffer of a fixed power of two capacity where every cell carries a
+// sequence number telling whether it is ready to be written or read
+// (D. Vyukov's bounded MPMC queue). push() sleeps while the queue is full,
+// which is how the stages of a pipeline apply backpressure on each other,
+// and pop() while it is empty, until the queue is closed.
+template <class T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity) {
+			size *= 2;
+		}
+		cells_.reset(new Cell[size]);
+		mask_ = size - 1;
+		for (size_t i = 0; i < size; ++i) {
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+	void push(T value)
+	{
+		notFull_.wait([&] { return try_push(value); });
+		notEmpty_.notify();
+	}
+
+	// false once the queue is closed and empty
+	bool pop(T &value)
+	{
+		bool popped = false;
+		notEmpty_.wait([&] {
+			popped = try_pop(value);
+			return popped || closed_.load(std::memory_order_acquire);
+		});
+		// what was pushed before close() is still popped
+		popped = popped || try_pop(value);
+		if (popped) {
+			notFull_.notify();
+		}
+		return popped;
+	}
+
+	// no more values will be pushed, wake the threads waiting in pop()
+	void close()
+	{
+		closed_.store(true, std::memory_order_release);
+		notEmpty_.notify();
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	bool try_push(T &value)
+	{
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		Cell *cell;
+		while (true) {
+			cell = &cells_[pos & mask_];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+			if (diff == 0) {
+				if (enqueuePos_.compare_exchange_weak(
+							pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = std::move(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(T &value)
+	{
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		Cell *cell;
+		while (true) {
+			cell = &cells_[pos & mask_];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+			if (diff == 0) {
+				if (dequeuePos_.compare_exchange_weak(
+							pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		value = std::move(cell->value);
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_ = 0;
+	// keep the producer and the consumer positions on separate cache lines
+	alignas(64) std::atomic<size_t> enqueuePos_ {0};
+	alignas(64) std::atomic<size_t> dequeuePos_ {0};
+	std::atomic<bool> closed_ {false};
+	Signal notFull_;
+	Signal notEmpty_;
+};
+
+} /* namespace lockfree */
+
+#endif /* SRC_BOUNDED_QUEUE_H_ */
@@ -8,6 +8,7 @@
  */
 #include "chromium_leveldb_comparator_provider.h"
 
+#include <content/browser/indexed_db/indexed_db_leveldb_coding.h>
 #include <content/browser/indexed_db/indexed_db_leveldb_operations.h>
 
 
@@ -18,4 +19,38 @@ const leveldb::Comparator *get_chromium_comparator()
 	return content::indexed_db::GetDefaultLevelDBComparator();
 }
 
+std::string encode_object_store_data_prefix(int64_t databaseId,
+											int64_t objectStoreId)
+{
+	using content::KeyPrefix;
+	using content::ObjectStoreDataKey;
+	return KeyPrefix::CreateWithSpecialIndex(databaseId, objectStoreId,
+			ObjectStoreDataKey::kSpecialIndexNumber).Encode();
+}
+
+std::string encode_object_store_data_limit(int64_t databaseId,
+										   int64_t objectStoreId)
+{
+	// the "exists" entries (index 2) of the same object store come right
+	// after the data records (index 1)
+	using content::KeyPrefix;
+	using content::ObjectStoreDataKey;
+	return KeyPrefix::CreateWithSpecialIndex(databaseId, objectStoreId,
+			ObjectStoreDataKey::kSpecialIndexNumber + 1).Encode();
+}
+
+std::string encode_string_key(const std::string &keyPrefix,
+							  const std::u16string &key, bool inArray)
+{
+	using blink::IndexedDBKey;
+	IndexedDBKey idbKey(base::string16(key.begin(), key.end()));
+	if (inArray) {
+		idbKey = IndexedDBKey(IndexedDBKey::KeyArray{idbKey});
+	}
+
+	std::string result = keyPrefix;
+	content::EncodeIDBKey(idbKey, &result);
+	return result;
+}
+
 } /* namespace leveldb_view */
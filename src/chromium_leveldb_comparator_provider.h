@@ -9,6 +9,9 @@
 #ifndef SRC_CHROMIUM_LEVELDB_COMPARATOR_PROVIDER_H_
 #define SRC_CHROMIUM_LEVELDB_COMPARATOR_PROVIDER_H_
 
+#include <cstdint>
+#include <string>
+
 namespace leveldb {
 class Comparator;
 }
@@ -17,6 +20,19 @@ namespace leveldb_view {
 
 const leveldb::Comparator *get_chromium_comparator();
 
+// key prefix shared by all records of an object store
+std::string encode_object_store_data_prefix(int64_t databaseId,
+											int64_t objectStoreId);
+
+// first key sorting after all records of an object store
+std::string encode_object_store_data_limit(int64_t databaseId,
+										   int64_t objectStoreId);
+
+// Append to a key prefix the encoding of a string primary key or, if inArray
+// is set, of an array primary key holding just that string.
+std::string encode_string_key(const std::string &keyPrefix,
+							  const std::u16string &key, bool inArray);
+
 } /* namespace leveldb_view */
 
 #endif /* SRC_CHROMIUM_LEVELDB_COMPARATOR_PROVIDER_H_ */
@@ -0,0 +1,456 @@
+/*
+ * civil_time.cpp - fast conversion of epoch times to civil dates and times
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "civil_time.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace civil {
+
+static const int64_t secondsPerDay = 86400;
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+	const int64_t q = a / b;
+	return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// H. Hinnant's algorithms, on 400 year eras starting on March 1st
+Date civil_from_days(int64_t days)
+{
+	days += 719468;
+	const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	const unsigned doe = (unsigned) (days - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	const unsigned day = doy - (153 * mp + 2) / 5 + 1;
+	const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+	return {(int64_t) yoe + era * 400 + (month <= 2), month, day};
+}
+
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+	year -= month <= 2;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const unsigned yoe = (unsigned) (year - era * 400);
+	const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 +
+			day - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t) doe - 719468;
+}
+
+static bool is_leap_year(int64_t year)
+{
+	return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+static uint32_t read_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+			(uint32_t) p[2] << 8 | p[3];
+}
+
+static uint64_t read_be64(const uint8_t *p)
+{
+	return (uint64_t) read_be32(p) << 32 | read_be32(p + 4);
+}
+
+bool TimeZone::load(const std::string &name, std::string &error)
+{
+	std::string path = name;
+	if (name.empty() || name[0] != '/') {
+		const char *dir = getenv("TZDIR");
+		path = std::string(dir && *dir ? dir : "/usr/share/zoneinfo") + '/' +
+				name;
+	}
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		error = "can't open " + path;
+		return false;
+	}
+	std::string data;
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		data.append(buffer, n);
+	}
+	fclose(file);
+
+	if (!parseData(data, error)) {
+		error = path + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+// RFC 8536: a header, the data with 32 bit times, then from version 2 a
+// second header, the same data with 64 bit times and a POSIX TZ rule
+// between newlines.
+bool TimeZone::parseData(const std::string &data, std::string &error)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(data.data());
+	const uint8_t *const pend = p + data.size();
+	static const size_t headerSize = 44;
+
+	struct Counts
+	{
+		uint32_t isUtc, isStd, leap, time, type, chars;
+	} counts;
+	auto readHeader = [&](const uint8_t *h) {
+		if (pend - h < (ptrdiff_t) headerSize || memcmp(h, "TZif", 4) != 0) {
+			return false;
+		}
+		counts = {read_be32(h + 20), read_be32(h + 24), read_be32(h + 28),
+				  read_be32(h + 32), read_be32(h + 36), read_be32(h + 40)};
+		return counts.type != 0;
+	};
+	auto dataSize = [&](size_t timeSize) {
+		return (uint64_t) counts.time * (timeSize + 1) + counts.type * 6ull +
+				counts.chars + counts.leap * (timeSize + 4ull) + counts.isStd +
+				counts.isUtc;
+	};
+
+	if (!readHeader(p)) {
+		error = "not a TZif file";
+		return false;
+	}
+	const bool hasV2 = p[4] >= '2';
+	size_t timeSize = 4;
+	if (hasV2) {
+		// skip the 32 bit data
+		const uint64_t size = dataSize(4);
+		if ((uint64_t) (pend - p) < headerSize + size ||
+			!readHeader(p + headerSize + size)) {
+			error = "truncated TZif file";
+			return false;
+		}
+		p += headerSize + size;
+		timeSize = 8;
+	}
+	p += headerSize;
+	if ((uint64_t) (pend - p) < dataSize(timeSize)) {
+		error = "truncated TZif file";
+		return false;
+	}
+
+	transitions_.clear();
+	offsets_.clear();
+	const uint8_t *times = p;
+	const uint8_t *types = times + counts.time * timeSize;
+	const uint8_t *infos = types + counts.time;
+	for (uint32_t i = 0; i < counts.time; ++i) {
+		const int64_t t = timeSize == 8 ? (int64_t) read_be64(times + 8 * i) :
+				(int32_t) read_be32(times + 4 * i);
+		if (types[i] >= counts.type ||
+			(!transitions_.empty() && t <= transitions_.back())) {
+			error = "bad transition";
+			return false;
+		}
+		transitions_.push_back(t);
+		offsets_.push_back((int32_t) read_be32(infos + 6 * types[i]));
+	}
+	// the times before the first transition use the first type
+	initialOffset_ = (int32_t) read_be32(infos);
+
+	hasRule_ = false;
+	if (hasV2) {
+		const uint8_t *footer = p + dataSize(timeSize);
+		const uint8_t *footerEnd = footer + 1;
+		while (footerEnd < pend && *footerEnd != '\n') {
+			footerEnd++;
+		}
+		if (footer < pend && *footer == '\n' && footerEnd < pend &&
+			footerEnd > footer + 1) {
+			const std::string tz(footer + 1, footerEnd);
+			if (!parseRule(tz.c_str(), rule_)) {
+				error = "unsupported TZ rule " + tz;
+				return false;
+			}
+			hasRule_ = true;
+		}
+	}
+	return true;
+}
+
+static bool parse_number(const char *&p, unsigned &value)
+{
+	if (*p < '0' || *p > '9') {
+		return false;
+	}
+	value = 0;
+	while (*p >= '0' && *p <= '9' && value < 100000) {
+		value = value * 10 + (*p++ - '0');
+	}
+	return true;
+}
+
+// [+-]hh[:mm[:ss]], in seconds
+static bool parse_time(const char *&p, int32_t &seconds)
+{
+	const int sign = *p == '-' ? -1 : 1;
+	if (*p == '-' || *p == '+') {
+		p++;
+	}
+	unsigned hours, minutes = 0, secs = 0;
+	if (!parse_number(p, hours) || hours > 167) {
+		return false;
+	}
+	if (*p == ':' && (!parse_number(++p, minutes) || minutes > 59)) {
+		return false;
+	}
+	if (*p == ':' && (!parse_number(++p, secs) || secs > 59)) {
+		return false;
+	}
+	seconds = sign * (int32_t) (hours * 3600 + minutes * 60 + secs);
+	return true;
+}
+
+// a zone abbreviation, letters or anything between '<' and '>'
+static bool parse_name(const char *&p)
+{
+	const char *start = p;
+	if (*p == '<') {
+		while (*p && *p != '>') {
+			p++;
+		}
+		return *p++ == '>';
+	}
+	while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) {
+		p++;
+	}
+	return p != start;
+}
+
+bool TimeZone::parseRule(const char *p, Rule &rule)
+{
+	// the offsets of POSIX are positive west of Greenwich
+	int32_t offset;
+	if (!parse_name(p) || !parse_time(p, offset)) {
+		return false;
+	}
+	rule.stdOffset = -offset;
+	rule.hasDst = *p != '\0';
+	if (!rule.hasDst) {
+		return true;
+	}
+	if (!parse_name(p)) {
+		return false;
+	}
+	rule.dstOffset = rule.stdOffset + 3600;
+	if (*p != ',' && *p != '\0') {
+		if (!parse_time(p, offset)) {
+			return false;
+		}
+		rule.dstOffset = -offset;
+	}
+
+	auto parseChange = [&p](Rule::Change &change) {
+		if (*p++ != ',') {
+			return false;
+		}
+		if (*p == 'M') {
+			change.kind = 'M';
+			p++;
+			if (!parse_number(p, change.month) || *p++ != '.' ||
+				!parse_number(p, change.week) || *p++ != '.' ||
+				!parse_number(p, change.day) || change.month < 1 ||
+				change.month > 12 || change.week < 1 || change.week > 5 ||
+				change.day > 6) {
+				return false;
+			}
+		} else {
+			change.kind = *p == 'J' ? 'J' : 'D';
+			if (*p == 'J') {
+				p++;
+			}
+			if (!parse_number(p, change.day) || change.day > 365 ||
+				(change.kind == 'J' && change.day == 0)) {
+				return false;
+			}
+		}
+		change.time = 7200;
+		return *p != '/' || parse_time(++p, change.time);
+	};
+	return parseChange(rule.start) && parseChange(rule.end) && *p == '\0';
+}
+
+// the UTC time of a change of the rule in a year
+int64_t TimeZone::ruleChange(int64_t year, const Rule::Change &change,
+							 int32_t offsetBefore) const
+{
+	int64_t day;
+	if (change.kind == 'M') {
+		const int64_t first = days_from_civil(year, change.month, 1);
+		const int64_t next = change.month == 12 ?
+				days_from_civil(year + 1, 1, 1) :
+				days_from_civil(year, change.month + 1, 1);
+		// 1970-01-01 was a Thursday
+		const unsigned weekday = (unsigned) (((first + 4) % 7 + 7) % 7);
+		day = first + (change.day + 7 - weekday) % 7 + (change.week - 1) * 7;
+		while (day >= next) {
+			day -= 7;
+		}
+	} else {
+		day = days_from_civil(year, 1, 1) + change.day;
+		// Jn counts from 1 and never counts February 29
+		if (change.kind == 'J') {
+			day -= change.day >= 60 && is_leap_year(year) ? 0 : 1;
+		}
+	}
+	return day * secondsPerDay + change.time - offsetBefore;
+}
+
+int32_t TimeZone::ruleOffset(int64_t utc, int64_t *start, int64_t *end) const
+{
+	const Rule &r = rule_;
+	if (!r.hasDst) {
+		*start = std::numeric_limits<int64_t>::min();
+		*end = std::numeric_limits<int64_t>::max();
+		return r.stdOffset;
+	}
+
+	const int64_t year = civil_from_days(floor_div(utc, secondsPerDay)).year;
+	const int64_t dstStart = ruleChange(year, r.start, r.stdOffset);
+	const int64_t dstEnd = ruleChange(year, r.end, r.dstOffset);
+	if (dstStart < dstEnd) {
+		// northern hemisphere, the summer is inside the year
+		if (utc < dstStart) {
+			*start = ruleChange(year - 1, r.end, r.dstOffset);
+			*end = dstStart;
+			return r.stdOffset;
+		}
+		if (utc < dstEnd) {
+			*start = dstStart;
+			*end = dstEnd;
+			return r.dstOffset;
+		}
+		*start = dstEnd;
+		*end = ruleChange(year + 1, r.start, r.stdOffset);
+		return r.stdOffset;
+	}
+
+	// southern hemisphere, the summer spans the new year
+	if (utc < dstEnd) {
+		*start = ruleChange(year - 1, r.start, r.stdOffset);
+		*end = dstEnd;
+		return r.dstOffset;
+	}
+	if (utc < dstStart) {
+		*start = dstEnd;
+		*end = dstStart;
+		return r.stdOffset;
+	}
+	*start = dstStart;
+	*end = ruleChange(year + 1, r.end, r.dstOffset);
+	return r.dstOffset;
+}
+
+int32_t TimeZone::offset(int64_t utc, int64_t *start, int64_t *end) const
+{
+	if (transitions_.empty() || utc < transitions_[0]) {
+		if (transitions_.empty() && hasRule_) {
+			return ruleOffset(utc, start, end);
+		}
+		*start = std::numeric_limits<int64_t>::min();
+		*end = transitions_.empty() ? std::numeric_limits<int64_t>::max() :
+				transitions_[0];
+		return initialOffset_;
+	}
+
+	const size_t i = std::upper_bound(transitions_.begin(), transitions_.end(),
+									  utc) - transitions_.begin() - 1;
+	if (i + 1 < transitions_.size()) {
+		*start = transitions_[i];
+		*end = transitions_[i + 1];
+		return offsets_[i];
+	}
+
+	// past the last transition
+	if (!hasRule_) {
+		*start = transitions_[i];
+		*end = std::numeric_limits<int64_t>::max();
+		return offsets_[i];
+	}
+	const int32_t offset = ruleOffset(utc, start, end);
+	*start = std::max(*start, transitions_[i]);
+	return offset;
+}
+
+TimestampFormatter::TimestampFormatter(const TimeZone *zone) :
+		zone_(zone), day_(std::numeric_limits<int64_t>::min())
+{
+	if (!zone_) {
+		periodStart_ = std::numeric_limits<int64_t>::min();
+		periodEnd_ = std::numeric_limits<int64_t>::max();
+	}
+}
+
+void TimestampFormatter::cacheDay(int64_t day)
+{
+	const Date date = civil_from_days(day);
+	const int n = snprintf(date_, sizeof(date_), "%04" PRId64 "-%02u-%02u",
+						   date.year, date.month, date.day);
+	dateLength_ = n > 0 ? std::min((size_t) n, sizeof(date_) - 1) : 0;
+	day_ = day;
+}
+
+void TimestampFormatter::cacheOffset(int64_t utc)
+{
+	offset_ = zone_->offset(utc, &periodStart_, &periodEnd_);
+	const unsigned offset = (unsigned) (offset_ < 0 ? -offset_ : offset_);
+	const unsigned seconds = offset % 60;
+	const int n = seconds == 0 ?
+			snprintf(suffix_, sizeof(suffix_), "%c%02u:%02u",
+					 offset_ < 0 ? '-' : '+', offset / 3600, offset / 60 % 60) :
+			snprintf(suffix_, sizeof(suffix_), "%c%02u:%02u:%02u",
+					 offset_ < 0 ? '-' : '+', offset / 3600, offset / 60 % 60,
+					 seconds);
+	suffixLength_ = n > 0 ? std::min((size_t) n, sizeof(suffix_) - 1) : 0;
+}
+
+static char *write_two_digits(char *p, unsigned value)
+{
+	p[0] = (char) ('0' + value / 10);
+	p[1] = (char) ('0' + value % 10);
+	return p + 2;
+}
+
+size_t TimestampFormatter::format(int64_t ms, char *out)
+{
+	const int64_t utc = floor_div(ms, 1000);
+	if (utc < periodStart_ || utc >= periodEnd_) {
+		cacheOffset(utc);
+	}
+	const int64_t local = utc + offset_;
+	const int64_t day = floor_div(local, secondsPerDay);
+	if (day != day_) {
+		cacheDay(day);
+	}
+	const unsigned seconds = (unsigned) (local - day * secondsPerDay);
+
+	char *p = out;
+	memcpy(p, date_, dateLength_);
+	p += dateLength_;
+	*p++ = 'T';
+	p = write_two_digits(p, seconds / 3600);
+	*p++ = '-';
+	p = write_two_digits(p, seconds / 60 % 60);
+	*p++ = '-';
+	p = write_two_digits(p, seconds % 60);
+	memcpy(p, suffix_, suffixLength_);
+	return p + suffixLength_ - out;
+}
+
+} /* namespace civil */
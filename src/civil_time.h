@@ -0,0 +1,116 @@
+/*
+ * civil_time.h - fast conversion of epoch times to civil dates and times
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_CIVIL_TIME_H_
+#define SRC_CIVIL_TIME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace civil {
+
+// a day of the proleptic Gregorian calendar
+struct Date
+{
+	int64_t year;
+	unsigned month; // 1 to 12
+	unsigned day;   // 1 to 31
+};
+
+// the date of a day counted from 1970-01-01, which is day 0
+Date civil_from_days(int64_t days);
+
+// the number of the day of a date, the inverse of civil_from_days()
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day);
+
+// The offsets from UTC of a time zone, read from a TZif file of the system
+// time zone database. The times past the last transition of the file follow
+// the POSIX TZ rule at its end. Leap seconds are ignored.
+class TimeZone
+{
+public:
+	// Load a zone by name, such as "Europe/Bucharest", from $TZDIR or
+	// /usr/share/zoneinfo, or from a path when the name starts with '/'.
+	// Returns false, with a message in `error`, when it can't be used.
+	bool load(const std::string &name, std::string &error);
+
+	// The offset in seconds at a UTC time in seconds. The offset doesn't
+	// change in [*start, *end), which callers can cache.
+	int32_t offset(int64_t utc, int64_t *start, int64_t *end) const;
+
+private:
+	// a POSIX TZ rule, "EET-2EEST,M3.5.0/3,M10.5.0/4"
+	struct Rule
+	{
+		// when daylight saving time starts or ends, in local time
+		struct Change
+		{
+			char kind = 'M'; // 'M' month.week.weekday, 'J' or 'D' a day
+			unsigned month = 0;
+			unsigned week = 0;
+			unsigned day = 0; // the weekday for 'M', else the day number
+			int32_t time = 7200;
+		};
+
+		int32_t stdOffset = 0;
+		int32_t dstOffset = 0;
+		bool hasDst = false;
+		Change start;
+		Change end;
+	};
+
+	bool parseData(const std::string &data, std::string &error);
+	static bool parseRule(const char *p, Rule &rule);
+	int64_t ruleChange(int64_t year, const Rule::Change &change,
+					   int32_t offsetBefore) const;
+	int32_t ruleOffset(int64_t utc, int64_t *start, int64_t *end) const;
+
+	std::vector<int64_t> transitions_; // UTC seconds, in increasing order
+	std::vector<int32_t> offsets_;     // in effect from each transition
+	int32_t initialOffset_ = 0;        // before the first transition
+	bool hasRule_ = false;
+	Rule rule_;
+};
+
+// Formats times in milliseconds since the epoch as "YYYY-MM-DDThh-mm-ss"
+// followed by "Z", or by the UTC offset of the time zone. The date of the
+// last day formatted and the last offset period of the zone are cached, so
+// a run of times from the same day only costs a few divisions. Not thread
+// safe, each thread should have its own.
+class TimestampFormatter
+{
+public:
+	static constexpr size_t maxLength = 40;
+
+	explicit TimestampFormatter(const TimeZone *zone = nullptr);
+
+	// Write the time to `out`, which has room for maxLength characters,
+	// and return the length written. The times must be within the range of
+	// the JavaScript Dates.
+	size_t format(int64_t ms, char *out);
+
+private:
+	void cacheDay(int64_t day);
+	void cacheOffset(int64_t utc);
+
+	const TimeZone *zone_;
+	int64_t day_;
+	char date_[24];
+	size_t dateLength_ = 0;
+	int64_t periodStart_ = 0;
+	int64_t periodEnd_ = 0;
+	int32_t offset_ = 0;
+	char suffix_[12] = "Z";
+	size_t suffixLength_ = 1;
+};
+
+} /* namespace civil */
+
+#endif /* SRC_CIVIL_TIME_H_ */
@@ -0,0 +1,154 @@
+/*
+ * output_buffer.cpp - buffered output of the formatted records
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "output_buffer.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace output {
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity) :
+		buffer_(new char[capacity]), capacity_(capacity), fd_(fd)
+{
+}
+
+OutputBuffer::OutputBuffer(Sink sink, size_t capacity) :
+		buffer_(new char[capacity]), capacity_(capacity), sink_(std::move(sink))
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+	flush();
+}
+
+OutputBuffer::OutputBuffer(OutputBuffer &&other) noexcept :
+		buffer_(std::move(other.buffer_)), size_(other.size_),
+		capacity_(other.capacity_), fd_(other.fd_),
+		sink_(std::move(other.sink_)), ok_(other.ok_)
+{
+	other.size_ = 0;
+	other.capacity_ = 0;
+	other.fd_ = -1;
+	other.sink_ = nullptr;
+}
+
+OutputBuffer &OutputBuffer::operator=(OutputBuffer &&other) noexcept
+{
+	if (this != &other) {
+		flush();
+		buffer_ = std::move(other.buffer_);
+		size_ = other.size_;
+		capacity_ = other.capacity_;
+		fd_ = other.fd_;
+		sink_ = std::move(other.sink_);
+		ok_ = other.ok_;
+		other.size_ = 0;
+		other.capacity_ = 0;
+		other.fd_ = -1;
+		other.sink_ = nullptr;
+	}
+	return *this;
+}
+
+bool OutputBuffer::flush()
+{
+	if (attached() && size_ != 0) {
+		writeAll(buffer_.get(), size_, nullptr, 0);
+		size_ = 0;
+	}
+	return ok_;
+}
+
+void OutputBuffer::appendSlow(const char *data, size_t size)
+{
+	// a large piece, the output of a whole batch of records, isn't copied
+	if (attached() && size >= capacity_ / 2) {
+		writeAll(buffer_.get(), size_, data, size);
+		size_ = 0;
+		return;
+	}
+	makeRoom(size);
+	memcpy(buffer_.get() + size_, data, size);
+	size_ += size;
+}
+
+void OutputBuffer::makeRoom(size_t size)
+{
+	if (attached()) {
+		flush();
+	}
+	if (size > capacity_ - size_) {
+		grow(size);
+	}
+}
+
+void OutputBuffer::grow(size_t size)
+{
+	const size_t capacity = std::max({(size_t) 4096, 2 * capacity_,
+									  size_ + size});
+	std::unique_ptr<char[]> buffer(new char[capacity]);
+	if (size_ != 0) {
+		memcpy(buffer.get(), buffer_.get(), size_);
+	}
+	buffer_ = std::move(buffer);
+	capacity_ = capacity;
+}
+
+// write both pieces, retrying the short writes
+bool OutputBuffer::writeAll(const char *first, size_t firstSize,
+							const char *second, size_t secondSize)
+{
+	if (sink_) {
+		if (ok_ && firstSize != 0) {
+			ok_ = sink_(first, firstSize);
+		}
+		if (ok_ && secondSize != 0) {
+			ok_ = sink_(second, secondSize);
+		}
+		return ok_;
+	}
+
+	struct iovec pieces[2] = {
+		{const_cast<char *>(first), firstSize},
+		{const_cast<char *>(second), secondSize}
+	};
+	struct iovec *piece = pieces;
+	int count = secondSize != 0 ? 2 : 1;
+	while (ok_ && count > 0) {
+		if (piece->iov_len == 0) {
+			piece++;
+			count--;
+			continue;
+		}
+		const ssize_t written = writev(fd_, piece, count);
+		if (written < 0) {
+			if (errno != EINTR) {
+				ok_ = false;
+			}
+			continue;
+		}
+		size_t left = (size_t) written;
+		while (count > 0 && left >= piece->iov_len) {
+			left -= piece->iov_len;
+			piece++;
+			count--;
+		}
+		if (count > 0) {
+			piece->iov_base = static_cast<char *>(piece->iov_base) + left;
+			piece->iov_len -= left;
+		}
+	}
+	return ok_;
+}
+
+} /* namespace output */
@@ -0,0 +1,187 @@
+/*
+ * output_buffer.h - buffered output of the formatted records
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_OUTPUT_BUFFER_H_
+#define SRC_OUTPUT_BUFFER_H_
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace output {
+
+// An append only text buffer the records are formatted into, without the
+// locale and the virtual calls of the iostreams. A buffer attached to a
+// file descriptor is written with write(2) whenever it fills up, the large
+// appends going straight to the file along with what was buffered in one
+// writev(2). A buffer attached to a sink hands the text over to it the same
+// way. A buffer in memory grows until it's cleared, the parallel scans use
+// them to hold the output of a piece until its turn comes.
+class OutputBuffer
+{
+public:
+	static constexpr size_t defaultCapacity = 1 << 20;
+
+	// takes the text written to the buffer, false when it can't
+	using Sink = std::function<bool(const char *data, size_t size)>;
+
+	// a buffer in memory
+	OutputBuffer() = default;
+
+	// a buffer of `capacity` bytes written to `fd`, which stays open
+	explicit OutputBuffer(int fd, size_t capacity = defaultCapacity);
+
+	// a buffer of `capacity` bytes handed to `sink`
+	explicit OutputBuffer(Sink sink, size_t capacity = defaultCapacity);
+
+	// writes what is left when attached to a file descriptor or a sink
+	~OutputBuffer();
+
+	OutputBuffer(const OutputBuffer &) = delete;
+	OutputBuffer &operator=(const OutputBuffer &) = delete;
+	OutputBuffer(OutputBuffer &&other) noexcept;
+	OutputBuffer &operator=(OutputBuffer &&other) noexcept;
+
+	void append(const char *data, size_t size)
+	{
+		if (size > capacity_ - size_) {
+			appendSlow(data, size);
+			return;
+		}
+		if (size != 0) {
+			memcpy(buffer_.get() + size_, data, size);
+			size_ += size;
+		}
+	}
+
+	void append(std::string_view s) { append(s.data(), s.size()); }
+
+	void append(char c)
+	{
+		if (size_ == capacity_) {
+			makeRoom(1);
+		}
+		buffer_[size_++] = c;
+	}
+
+	// Room for `size` more characters to be formatted in place, then
+	// committed with advance().
+	char *reserve(size_t size)
+	{
+		if (size > capacity_ - size_) {
+			makeRoom(size);
+		}
+		return buffer_.get() + size_;
+	}
+
+	void advance(size_t size) { size_ += size; }
+
+	template <class Integer>
+	void appendInteger(Integer value)
+	{
+		char *p = reserve(24);
+		size_ += std::to_chars(p, p + 24, value).ptr - p;
+	}
+
+	OutputBuffer &operator<<(char c)
+	{
+		append(c);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(const char *s)
+	{
+		append(s, strlen(s));
+		return *this;
+	}
+
+	OutputBuffer &operator<<(std::string_view s)
+	{
+		append(s.data(), s.size());
+		return *this;
+	}
+
+	OutputBuffer &operator<<(const std::string &s)
+	{
+		append(s.data(), s.size());
+		return *this;
+	}
+
+	OutputBuffer &operator<<(int v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(unsigned v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(long v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(unsigned long v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(long long v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	OutputBuffer &operator<<(unsigned long long v)
+	{
+		appendInteger(v);
+		return *this;
+	}
+
+	// the text not written yet
+	const char *data() const { return buffer_.get(); }
+	size_t size() const { return size_; }
+	std::string_view view() const { return {buffer_.get(), size_}; }
+
+	void clear() { size_ = 0; }
+
+	// Write the buffered text to the file descriptor or the sink, if any.
+	// False once a write has failed, the output is then dropped.
+	bool flush();
+
+	bool ok() const { return ok_; }
+
+private:
+	void appendSlow(const char *data, size_t size);
+	void makeRoom(size_t size);
+	void grow(size_t size);
+	bool writeAll(const char *first, size_t firstSize, const char *second,
+				  size_t secondSize);
+
+	bool attached() const { return fd_ >= 0 || sink_; }
+
+	std::unique_ptr<char[]> buffer_;
+	size_t size_ = 0;
+	size_t capacity_ = 0;
+	int fd_ = -1;
+	Sink sink_;
+	bool ok_ = true;
+};
+
+} /* namespace output */
+
+#endif /* SRC_OUTPUT_BUFFER_H_ */
@@ -0,0 +1,573 @@
+/*
+ * record_archive.cpp - an indexed archive of records, queried in place
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "record_archive.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+namespace archive {
+
+namespace {
+
+const size_t alignment = 8;
+
+size_t padding(uint64_t size)
+{
+	return (alignment - size % alignment) % alignment;
+}
+
+uint32_t slot_size(ColumnType type)
+{
+	return type == ColumnType::Text ? sizeof(TextSlot) : sizeof(int64_t);
+}
+
+// whether [offset, offset + size) is inside a file of `fileSize` bytes
+bool in_file(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+} // namespace
+
+ArchiveWriter::~ArchiveWriter()
+{
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(dictionary_);
+	ZSTD_freeCCtx(compressor_);
+#endif
+	if (fd_ >= 0) {
+		// an archive which wasn't finished is of no use
+		file_.clear();
+		file_ = output::OutputBuffer();
+		close(fd_);
+		unlink(path_.c_str());
+	}
+}
+
+bool ArchiveWriter::open(const char *path, const std::vector<Column> &columns,
+						 size_t keyColumn, size_t timeColumn,
+						 int compressedColumn)
+{
+	if (compressedColumn >= 0 && ((size_t) compressedColumn == keyColumn ||
+			(size_t) compressedColumn >= columns.size() ||
+			columns[compressedColumn].type != ColumnType::Text)) {
+		error_ = "Only a text column which isn't the key can be compressed";
+		return false;
+	}
+#ifndef HAVE_ZSTD
+	if (compressedColumn >= 0) {
+		error_ = "this build has no compression, the zstd library was missing";
+		return false;
+	}
+#endif
+	fd_ = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		error_ = std::string(path) + ": " + strerror(errno);
+		return false;
+	}
+	path_ = path;
+	keyColumn_ = keyColumn;
+	timeColumn_ = timeColumn;
+	compressedColumn_ = compressedColumn;
+	sampling_ = compressedColumn >= 0;
+	decoder_.emplace(std::vector<size_t> {columns.size()});
+
+	// the header is written last, in its place, the names of the columns
+	// start the string heap
+	file_ = output::OutputBuffer(fd_);
+	const FileHeader header = {};
+	file_.append(reinterpret_cast<const char *>(&header), sizeof(header));
+	for (const Column &column : columns) {
+		FieldInfo field = {};
+		field.nameOffset = addText(column.name, false);
+		field.nameSize = (uint32_t) column.name.size();
+		field.type = column.type;
+		field.slotOffset = recordSize_;
+		fields_.push_back(field);
+		recordSize_ += slot_size(column.type);
+	}
+	return true;
+}
+
+uint64_t ArchiveWriter::addText(std::string_view text, bool intern)
+{
+	if (intern) {
+		const auto found = interned_.find(text);
+		if (found != interned_.end()) {
+			return found->second;
+		}
+	}
+	const uint64_t offset = stringsSize_;
+	file_.append(text);
+	stringsSize_ += text.size();
+	if (intern) {
+		internedText_.emplace_back(text);
+		interned_.emplace(internedText_.back(), offset);
+	}
+	return offset;
+}
+
+// compress a value with the dictionary, when there is one and it helps
+TextSlot ArchiveWriter::addCompressedText(std::string_view text)
+{
+	plainBytes_ += text.size();
+#ifdef HAVE_ZSTD
+	if (dictionary_ && text.size() <= maxCompressedValueSize) {
+		compressed_.resize(ZSTD_compressBound(text.size()));
+		const size_t size = ZSTD_compress_usingCDict(compressor_,
+				compressed_.data(), compressed_.size(), text.data(),
+				text.size(), dictionary_);
+		if (!ZSTD_isError(size) && size < text.size()) {
+			storedBytes_ += size;
+			const uint64_t offset = addText(
+					std::string_view(compressed_.data(), size), false);
+			return {offset, (uint32_t) size, textCompressed};
+		}
+	}
+#endif
+	storedBytes_ += text.size();
+	return {addText(text, false), (uint32_t) text.size(), 0};
+}
+
+void ArchiveWriter::setSlot(uint32_t record, size_t column,
+							const TextSlot &slot)
+{
+	memcpy(records_.data() + (size_t) record * recordSize_ +
+		   fields_[column].slotOffset, &slot, sizeof(slot));
+}
+
+// Train the dictionary on the sampled values, then store them. Without
+// enough samples for a dictionary the values are stored as they are.
+void ArchiveWriter::trainDictionary()
+{
+	sampling_ = false;
+#ifdef HAVE_ZSTD
+	std::string dictionary(dictionaryCapacity, '\0');
+	const size_t size = sampleSizes_.empty() ? 0 : ZDICT_trainFromBuffer(
+			dictionary.data(), dictionary.size(), samples_.data(),
+			sampleSizes_.data(), (unsigned) sampleSizes_.size());
+	if (!sampleSizes_.empty() && !ZDICT_isError(size)) {
+		dictionaryOffset_ = addText(std::string_view(dictionary.data(), size),
+									false);
+		dictionarySize_ = size;
+		compressor_ = ZSTD_createCCtx();
+		dictionary_ = ZSTD_createCDict(dictionary.data(), size,
+									   compressionLevel);
+	}
+#endif
+
+	const char *sample = samples_.data();
+	for (size_t i = 0; i < sampleSizes_.size(); ++i) {
+		setSlot(sampleRecords_[i], compressedColumn_,
+				addCompressedText(std::string_view(sample, sampleSizes_[i])));
+		sample += sampleSizes_[i];
+	}
+	std::string().swap(samples_);
+	std::vector<size_t>().swap(sampleSizes_);
+	std::vector<uint32_t>().swap(sampleRecords_);
+}
+
+bool ArchiveWriter::load(const char *data, size_t size)
+{
+	if (!error_.empty()) {
+		return false;
+	}
+	const bool ok = decoder_->decode(data, size,
+			[this](size_t, const row_stream::Value *values) {
+		return addRecord(values);
+	});
+	if (!ok && error_.empty()) {
+		error_ = "Bad row";
+	}
+	return ok && file_.ok();
+}
+
+bool ArchiveWriter::addRecord(const row_stream::Value *values)
+{
+	using row_stream::Value;
+
+	if (recordCount_ == UINT32_MAX) {
+		error_ = "Too many records";
+		return false;
+	}
+	const size_t start = records_.size();
+	records_.resize(start + recordSize_);
+	uint8_t *record = records_.data() + start;
+	for (size_t i = 0; i < fields_.size(); ++i) {
+		const Value &value = values[i];
+		uint8_t *slot = record + fields_[i].slotOffset;
+		if (fields_[i].type == ColumnType::Time) {
+			const int64_t ms = value.type == Value::Integer ? value.integer :
+					nullTime;
+			memcpy(slot, &ms, sizeof(ms));
+			continue;
+		}
+
+		TextSlot text = {nullText, 0, 0};
+		if (value.type == Value::Text && (int) i == compressedColumn_) {
+			if (sampling_) {
+				// stored once the dictionary is trained
+				samples_.append(value.text.data(), value.text.size());
+				sampleSizes_.push_back(value.text.size());
+				sampleRecords_.push_back((uint32_t) recordCount_);
+			} else {
+				text = addCompressedText(value.text);
+			}
+		} else if (value.type == Value::Text) {
+			const bool isKey = i == keyColumn_;
+			text.offset = addText(value.text, isKey ||
+					value.text.size() <= internMaxSize);
+			text.size = (uint32_t) value.text.size();
+			if (isKey) {
+				keys_.insert(text.offset);
+			}
+		}
+		memcpy(slot, &text, sizeof(text));
+	}
+	recordCount_++;
+	if (sampling_ && samples_.size() >= sampleBytes) {
+		trainDictionary();
+	}
+	return true;
+}
+
+bool ArchiveWriter::finish()
+{
+	if (!error_.empty()) {
+		return false;
+	}
+	if (decoder_->hasPending()) {
+		error_ = "The last row is incomplete";
+		return false;
+	}
+	if (sampling_) {
+		trainDictionary();
+	}
+
+	FileHeader header = {};
+	memcpy(header.magic, fileMagic, sizeof(fileMagic));
+	header.version = fileVersion;
+	header.fieldCount = (uint32_t) fields_.size();
+	header.recordCount = recordCount_;
+	header.recordSize = recordSize_;
+	header.keyField = (uint32_t) keyColumn_;
+	header.timeField = (uint32_t) timeColumn_;
+	header.stringsOffset = sizeof(FileHeader);
+	header.stringsSize = stringsSize_;
+	header.dictionaryOffset = dictionaryOffset_;
+	header.dictionarySize = dictionarySize_;
+
+	file_.append("\0\0\0\0\0\0\0", padding(stringsSize_));
+	header.fieldsOffset = header.stringsOffset + stringsSize_ +
+			padding(stringsSize_);
+	file_.append(reinterpret_cast<const char *>(fields_.data()),
+				 fields_.size() * sizeof(FieldInfo));
+	header.recordsOffset = header.fieldsOffset +
+			fields_.size() * sizeof(FieldInfo);
+	file_.append(reinterpret_cast<const char *>(records_.data()),
+				 records_.size());
+
+	// the keys in the order of their text, for the key index
+	std::vector<std::pair<std::string_view, uint64_t>> keys;
+	for (const auto &[text, offset] : interned_) {
+		if (keys_.count(offset) != 0) {
+			keys.emplace_back(text, offset);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	std::unordered_map<uint64_t, uint32_t> keyRanks;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		keyRanks.emplace(keys[i].second, (uint32_t) i + 1); // 0 for null
+	}
+
+	struct IndexEntry
+	{
+		uint32_t keyRank;
+		int64_t time;
+		uint32_t record;
+	};
+	std::vector<IndexEntry> entries(recordCount_);
+	for (uint32_t i = 0; i < recordCount_; ++i) {
+		const uint8_t *record = records_.data() + (size_t) i * recordSize_;
+		TextSlot key;
+		memcpy(&key, record + fields_[keyColumn_].slotOffset, sizeof(key));
+		entries[i].keyRank = key.offset == nullText ? 0 : keyRanks[key.offset];
+		memcpy(&entries[i].time, record + fields_[timeColumn_].slotOffset, 8);
+		entries[i].record = i;
+	}
+	std::vector<uint8_t>().swap(records_);
+
+	std::vector<uint32_t> index(recordCount_);
+	auto writeIndex = [&]() {
+		for (size_t i = 0; i < entries.size(); ++i) {
+			index[i] = entries[i].record;
+		}
+		file_.append(reinterpret_cast<const char *>(index.data()),
+					 index.size() * sizeof(uint32_t));
+		file_.append("\0\0\0\0\0\0\0", padding(index.size() * 4));
+	};
+	std::sort(entries.begin(), entries.end(),
+			  [](const IndexEntry &a, const IndexEntry &b) {
+		return std::tie(a.keyRank, a.time, a.record) <
+				std::tie(b.keyRank, b.time, b.record);
+	});
+	header.keyIndexOffset = header.recordsOffset +
+			(uint64_t) recordCount_ * recordSize_;
+	writeIndex();
+	std::sort(entries.begin(), entries.end(),
+			  [](const IndexEntry &a, const IndexEntry &b) {
+		return std::tie(a.time, a.record) < std::tie(b.time, b.record);
+	});
+	header.timeIndexOffset = header.keyIndexOffset + recordCount_ * 4 +
+			padding(recordCount_ * 4);
+	writeIndex();
+
+	if (!file_.flush()) {
+		return fail("Writing the archive");
+	}
+	if (pwrite(fd_, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+		return fail("Writing the archive header");
+	}
+	if (close(fd_) != 0) {
+		fd_ = -1;
+		return fail("Closing the archive");
+	}
+	fd_ = -1;
+	return true;
+}
+
+bool ArchiveWriter::fail(const std::string &what)
+{
+	error_ = what + ": " + strerror(errno);
+	return false;
+}
+
+Archive::~Archive()
+{
+#ifdef HAVE_ZSTD
+	ZSTD_freeDDict(dictionary_);
+	ZSTD_freeDCtx(decompressor_);
+#endif
+	if (data_) {
+		munmap(const_cast<uint8_t *>(data_), fileSize_);
+	}
+}
+
+bool Archive::open(const char *path, std::string &error)
+{
+	const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		error = std::string(path) + ": " + strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(FileHeader)) {
+		close(fd);
+		error = std::string(path) + " isn't an archive";
+		return false;
+	}
+	fileSize_ = (size_t) st.st_size;
+	void *data = mmap(nullptr, fileSize_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		error = std::string(path) + ": " + strerror(errno);
+		return false;
+	}
+	data_ = static_cast<const uint8_t *>(data);
+	header_ = reinterpret_cast<const FileHeader *>(data_);
+
+	const FileHeader &h = *header_;
+	const uint64_t count = h.recordCount;
+	const uint64_t indexSize = count * sizeof(uint32_t);
+	bool ok = memcmp(h.magic, fileMagic, sizeof(fileMagic)) == 0;
+	if (ok && h.version != fileVersion) {
+		error = std::string(path) + " is an archive of version " +
+				std::to_string(h.version);
+		return false;
+	}
+	ok = ok && count <= UINT32_MAX && h.recordSize != 0 &&
+			h.fieldCount <= h.recordSize &&
+			in_file(h.stringsOffset, h.stringsSize, fileSize_) &&
+			in_file(h.fieldsOffset, (uint64_t) h.fieldCount * sizeof(FieldInfo),
+					fileSize_) &&
+			in_file(h.recordsOffset, count * h.recordSize, fileSize_) &&
+			in_file(h.keyIndexOffset, indexSize, fileSize_) &&
+			in_file(h.timeIndexOffset, indexSize, fileSize_) &&
+			(h.fieldsOffset | h.recordsOffset | h.recordSize |
+					h.keyIndexOffset | h.timeIndexOffset) % alignment == 0 &&
+			h.keyField < h.fieldCount && h.timeField < h.fieldCount;
+	if (ok) {
+		fields_ = reinterpret_cast<const FieldInfo *>(data_ + h.fieldsOffset);
+		for (uint32_t i = 0; ok && i < h.fieldCount; ++i) {
+			const FieldInfo &field = fields_[i];
+			ok = (field.type == ColumnType::Text ||
+				  field.type == ColumnType::Time) &&
+					field.slotOffset % alignment == 0 &&
+					in_file(field.slotOffset, slot_size(field.type),
+							h.recordSize) &&
+					in_file(field.nameOffset, field.nameSize, h.stringsSize);
+		}
+		ok = ok && fields_[h.keyField].type == ColumnType::Text &&
+				fields_[h.timeField].type == ColumnType::Time;
+	}
+	if (ok) {
+		records_ = data_ + h.recordsOffset;
+		strings_ = reinterpret_cast<const char *>(data_ + h.stringsOffset);
+		keyIndex_ = reinterpret_cast<const uint32_t *>(data_ +
+				h.keyIndexOffset);
+		timeIndex_ = reinterpret_cast<const uint32_t *>(data_ +
+				h.timeIndexOffset);
+		for (uint64_t i = 0; ok && i < count; ++i) {
+			ok = keyIndex_[i] < count && timeIndex_[i] < count;
+		}
+	}
+	if (ok && h.dictionarySize != 0) {
+#ifdef HAVE_ZSTD
+		ok = in_file(h.dictionaryOffset, h.dictionarySize, h.stringsSize);
+		if (ok) {
+			decompressor_ = ZSTD_createDCtx();
+			dictionary_ = ZSTD_createDDict(strings_ + h.dictionaryOffset,
+										   h.dictionarySize);
+			ok = decompressor_ && dictionary_;
+		}
+#else
+		error = std::string(path) + " is compressed, this build has no " +
+				"decompression, the zstd library was missing";
+		return false;
+#endif
+	}
+	if (!ok) {
+		error = std::string(path) + " isn't a valid archive";
+		return false;
+	}
+	return true;
+}
+
+int Archive::column(std::string_view name) const
+{
+	for (uint32_t i = 0; i < header_->fieldCount; ++i) {
+		const FieldInfo &field = fields_[i];
+		if (name == std::string_view(strings_ + field.nameOffset,
+									 field.nameSize)) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+std::optional<std::string_view> Archive::storedText(uint32_t record,
+													size_t column) const
+{
+	TextSlot slot;
+	memcpy(&slot, this->record(record) + fields_[column].slotOffset,
+		   sizeof(slot));
+	// the values out of the heap are taken as missing, like the nulls
+	if (!in_file(slot.offset, slot.size, header_->stringsSize) ||
+		(slot.flags & textCompressed) != 0) {
+		return std::nullopt;
+	}
+	return std::string_view(strings_ + slot.offset, slot.size);
+}
+
+std::optional<std::string_view> Archive::text(uint32_t record, size_t column,
+											  std::string &buffer) const
+{
+	TextSlot slot;
+	memcpy(&slot, this->record(record) + fields_[column].slotOffset,
+		   sizeof(slot));
+	if (!in_file(slot.offset, slot.size, header_->stringsSize)) {
+		return std::nullopt;
+	}
+	const char *data = strings_ + slot.offset;
+	if ((slot.flags & textCompressed) == 0) {
+		return std::string_view(data, slot.size);
+	}
+
+#ifdef HAVE_ZSTD
+	const unsigned long long size = ZSTD_getFrameContentSize(data, slot.size);
+	if (!dictionary_ || size > maxCompressedValueSize) {
+		return std::nullopt;
+	}
+	buffer.resize(size);
+	const size_t result = ZSTD_decompress_usingDDict(decompressor_,
+			buffer.data(), buffer.size(), data, slot.size, dictionary_);
+	if (ZSTD_isError(result) || result != size) {
+		return std::nullopt;
+	}
+	return std::string_view(buffer.data(), size);
+#else
+	(void) buffer;
+	return std::nullopt;
+#endif
+}
+
+std::optional<int64_t> Archive::time(uint32_t record, size_t column) const
+{
+	int64_t ms;
+	memcpy(&ms, this->record(record) + fields_[column].slotOffset, sizeof(ms));
+	if (ms == nullTime) {
+		return std::nullopt;
+	}
+	return ms;
+}
+
+int64_t Archive::recordTime(uint32_t record) const
+{
+	int64_t ms;
+	memcpy(&ms, this->record(record) + fields_[header_->timeField].slotOffset,
+		   sizeof(ms));
+	return ms;
+}
+
+RecordRange Archive::query(const std::optional<std::string_view> &key,
+						   const std::optional<int64_t> &from,
+						   const std::optional<int64_t> &to) const
+{
+	const uint32_t *first = timeIndex_;
+	const uint32_t *last = timeIndex_ + header_->recordCount;
+	if (key) {
+		// the nulls sort first
+		auto keyLess = [this](uint32_t record, std::string_view key) {
+			const auto text = storedText(record, header_->keyField);
+			return !text || *text < key;
+		};
+		auto keyGreater = [this](std::string_view key, uint32_t record) {
+			const auto text = storedText(record, header_->keyField);
+			return text && key < *text;
+		};
+		first = keyIndex_;
+		last = keyIndex_ + header_->recordCount;
+		first = std::lower_bound(first, last, *key, keyLess);
+		last = std::upper_bound(first, last, *key, keyGreater);
+	}
+	if (from || to) {
+		// the records without a time are left out of a time range
+		const int64_t start = std::max(from.value_or(nullTime), nullTime + 1);
+		const int64_t end = to.value_or(INT64_MAX);
+		auto timeLess = [this](uint32_t record, int64_t ms) {
+			return recordTime(record) < ms;
+		};
+		first = std::lower_bound(first, last, start, timeLess);
+		last = std::max(first, std::lower_bound(first, last, end, timeLess));
+	}
+	return {first, last};
+}
+
+} /* namespace archive */
@@ -0,0 +1,264 @@
+/*
+ * record_archive.h - an indexed archive of records, queried in place
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_RECORD_ARCHIVE_H_
+#define SRC_RECORD_ARCHIVE_H_
+
+#include "output_buffer.h"
+#include "row_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_DDict_s;
+
+// A file holding the records of a scan so that they can be queried without
+// scanning the LevelDB database again. It is read with mmap(2), nothing is
+// parsed when it is opened:
+//
+//   FileHeader              at offset 0
+//   string heap             the names of the columns and the text values
+//   FieldInfo[fieldCount]   the columns, aligned to 8 bytes
+//   records                 fixed width, a slot per column
+//   key index               uint32_t record numbers sorted by the key
+//                           column, then by the time column
+//   time index              uint32_t record numbers sorted by time
+//
+// A text slot is a TextSlot, a time slot an int64_t of milliseconds since
+// the epoch. The numbers are little endian, like the hosts which read them.
+//
+// The values of one column can be compressed with Zstandard, each on its
+// own so that a record can still be read alone, with a dictionary trained
+// on the first values and stored in the string heap. The texts are short
+// and alike, the dictionary provides what a single one lacks to compress
+// well. The values which wouldn't be smaller are stored as they are.
+namespace archive {
+
+enum class ColumnType : uint32_t {
+	Text = 1,
+	Time = 2
+};
+
+struct Column
+{
+	std::string_view name;
+	ColumnType type;
+};
+
+struct FileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t fieldCount;
+	uint64_t recordCount;
+	uint32_t recordSize;
+	uint32_t keyField;  // a text column
+	uint32_t timeField; // a time column
+	uint32_t reserved;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+	uint64_t fieldsOffset;
+	uint64_t recordsOffset;
+	uint64_t keyIndexOffset;
+	uint64_t timeIndexOffset;
+	// the Zstandard dictionary in the string heap, of size 0 when there are
+	// no compressed values
+	uint64_t dictionaryOffset;
+	uint64_t dictionarySize;
+};
+
+struct FieldInfo
+{
+	uint64_t nameOffset; // in the string heap
+	uint32_t nameSize;
+	ColumnType type;
+	uint32_t slotOffset; // in the record
+	uint32_t reserved;
+};
+
+struct TextSlot
+{
+	uint64_t offset; // in the string heap, nullText when null
+	uint32_t size;   // as stored
+	uint32_t flags;
+};
+
+// a TextSlot flag, the value is a Zstandard frame
+const uint32_t textCompressed = 1;
+// the values larger than this are never compressed
+const size_t maxCompressedValueSize = 64 << 20;
+
+const char fileMagic[8] = {'S', 'K', 'C', 'V', 'A', 'R', 'C', 0};
+const uint32_t fileVersion = 1;
+const uint64_t nullText = UINT64_MAX;
+const int64_t nullTime = INT64_MIN;
+
+// Writes the rows encoded with row_stream, those of table 0, into a new
+// archive. The text values are written to the file as they come, only the
+// records and the short strings, which are stored once, are kept in memory
+// until finish() sorts the indexes.
+class ArchiveWriter
+{
+public:
+	// the text values up to this size are stored once, the keys always
+	static constexpr size_t internMaxSize = 64;
+
+	// the values of the compressed column sampled to train the dictionary
+	static constexpr size_t sampleBytes = 8 << 20;
+	static constexpr size_t dictionaryCapacity = 64 * 1024;
+	static constexpr int compressionLevel = 9;
+
+	ArchiveWriter() = default;
+	~ArchiveWriter();
+
+	ArchiveWriter(const ArchiveWriter &) = delete;
+	ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+	// Create the file at `path`, which shouldn't exist yet, the values of
+	// the text column `compressedColumn`, if any, are compressed. False on
+	// error, see error().
+	bool open(const char *path, const std::vector<Column> &columns,
+			  size_t keyColumn, size_t timeColumn, int compressedColumn = -1);
+
+	// Add the records encoded in `data`, split anywhere between the calls.
+	bool load(const char *data, size_t size);
+
+	// sort the indexes and complete the file
+	bool finish();
+
+	uint64_t records() const { return recordCount_; }
+
+	// the size of the values of the compressed column, and as stored
+	uint64_t plainBytes() const { return plainBytes_; }
+	uint64_t storedBytes() const { return storedBytes_; }
+	uint64_t dictionarySize() const { return dictionarySize_; }
+
+	const std::string &error() const { return error_; }
+
+private:
+	bool addRecord(const row_stream::Value *values);
+	uint64_t addText(std::string_view text, bool intern);
+	TextSlot addCompressedText(std::string_view text);
+	void setSlot(uint32_t record, size_t column, const TextSlot &slot);
+	void trainDictionary();
+	bool fail(const std::string &what);
+
+	int fd_ = -1;
+	std::string path_;
+	std::vector<FieldInfo> fields_;
+	uint32_t recordSize_ = 0;
+	size_t keyColumn_ = 0;
+	size_t timeColumn_ = 0;
+	std::optional<row_stream::RowDecoder> decoder_;
+
+	output::OutputBuffer file_;  // the header then the string heap
+	uint64_t stringsSize_ = 0;
+	std::vector<uint8_t> records_;
+	uint64_t recordCount_ = 0;
+	// the strings stored once, and those of the keys
+	std::deque<std::string> internedText_;
+	std::unordered_map<std::string_view, uint64_t> interned_;
+	std::unordered_set<uint64_t> keys_;
+
+	// the values of the compressed column are sampled, with their records,
+	// until the dictionary is trained
+	int compressedColumn_ = -1;
+	bool sampling_ = false;
+	std::string samples_;
+	std::vector<size_t> sampleSizes_;
+	std::vector<uint32_t> sampleRecords_;
+	ZSTD_CCtx_s *compressor_ = nullptr;
+	ZSTD_CDict_s *dictionary_ = nullptr;
+	std::string compressed_;
+	uint64_t dictionaryOffset_ = 0;
+	uint64_t dictionarySize_ = 0;
+	uint64_t plainBytes_ = 0;
+	uint64_t storedBytes_ = 0;
+	std::string error_;
+};
+
+// the record numbers of a query, in the order of an index
+struct RecordRange
+{
+	const uint32_t *first = nullptr;
+	const uint32_t *last = nullptr;
+
+	const uint32_t *begin() const { return first; }
+	const uint32_t *end() const { return last; }
+	size_t size() const { return last - first; }
+};
+
+// An archive mapped in memory. The file is checked when it is opened, so
+// that the records and the indexes can then be read without checks. The
+// compressed values are decompressed one at a time, by one thread.
+class Archive
+{
+public:
+	Archive() = default;
+	~Archive();
+
+	Archive(const Archive &) = delete;
+	Archive &operator=(const Archive &) = delete;
+
+	bool open(const char *path, std::string &error);
+
+	uint64_t size() const { return header_->recordCount; }
+
+	// the number of the column named `name`, -1 when there is none
+	int column(std::string_view name) const;
+	ColumnType columnType(size_t column) const { return fields_[column].type; }
+
+	// A text value, in `buffer` when it is compressed. The values which
+	// can't be read, out of the heap or not decompressing, are missing.
+	std::optional<std::string_view> text(uint32_t record, size_t column,
+										 std::string &buffer) const;
+	std::optional<int64_t> time(uint32_t record, size_t column) const;
+
+	// The records whose key is `key`, when given, and whose time is in
+	// [from, to), when either is given, by binary search in the indexes.
+	// In the order of their times, those without a time first.
+	RecordRange query(const std::optional<std::string_view> &key,
+					  const std::optional<int64_t> &from,
+					  const std::optional<int64_t> &to) const;
+
+private:
+	const uint8_t *record(uint32_t record) const
+	{
+		return records_ + (size_t) record * header_->recordSize;
+	}
+
+	// a text value as it is stored, missing when it is compressed
+	std::optional<std::string_view> storedText(uint32_t record,
+											   size_t column) const;
+	int64_t recordTime(uint32_t record) const;
+
+	const uint8_t *data_ = nullptr;
+	size_t fileSize_ = 0;
+	const FileHeader *header_ = nullptr;
+	const FieldInfo *fields_ = nullptr;
+	const uint8_t *records_ = nullptr;
+	const char *strings_ = nullptr;
+	const uint32_t *keyIndex_ = nullptr;
+	const uint32_t *timeIndex_ = nullptr;
+	ZSTD_DCtx_s *decompressor_ = nullptr;
+	ZSTD_DDict_s *dictionary_ = nullptr;
+};
+
+} /* namespace archive */
+
+#endif /* SRC_RECORD_ARCHIVE_H_ */
@@ -0,0 +1,92 @@
+/*
+ * record_arena.cpp - bump allocator reset after each parsed record
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "record_arena.h"
+
+#include <atomic>
+
+namespace arena {
+
+static std::atomic<uint64_t> totalRecords {0};
+static std::atomic<uint64_t> totalAllocations {0};
+static std::atomic<uint64_t> totalHeapAllocations {0};
+static std::atomic<uint64_t> totalHeapBytes {0};
+
+ArenaStats global_arena_stats()
+{
+	ArenaStats stats;
+	stats.records = totalRecords.load();
+	stats.allocations = totalAllocations.load();
+	stats.heapAllocations = totalHeapAllocations.load();
+	stats.heapBytes = totalHeapBytes.load();
+	return stats;
+}
+
+RecordArena::RecordArena(size_t chunkSize) : chunkSize_(chunkSize)
+{
+}
+
+RecordArena::~RecordArena()
+{
+	totalAllocations += allocations_;
+}
+
+void RecordArena::reset()
+{
+	totalRecords++;
+	totalAllocations += allocations_;
+	allocations_ = 0;
+
+	current_ = 0;
+	if (!chunks_.empty()) {
+		ptr_ = chunks_[0].data.get();
+		end_ = ptr_ + chunks_[0].size;
+	}
+}
+
+static char *align_up(char *p, size_t alignment)
+{
+	const uintptr_t u = reinterpret_cast<uintptr_t>(p);
+	return reinterpret_cast<char *>((u + alignment - 1) & ~(alignment - 1));
+}
+
+void RecordArena::nextChunk(size_t bytes, size_t alignment)
+{
+	const size_t needed = bytes + alignment;
+
+	// reuse the chunks kept from the previous records first
+	size_t next = chunks_.empty() ? 0 : current_ + 1;
+	while (next < chunks_.size() && chunks_[next].size < needed) {
+		next++;
+	}
+
+	if (next == chunks_.size()) {
+		const size_t size = needed > chunkSize_ ? needed : chunkSize_;
+		chunks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+		totalHeapAllocations++;
+		totalHeapBytes += size;
+	}
+
+	current_ = next;
+	ptr_ = chunks_[next].data.get();
+	end_ = ptr_ + chunks_[next].size;
+}
+
+void *RecordArena::do_allocate(size_t bytes, size_t alignment)
+{
+	char *p = ptr_ ? align_up(ptr_, alignment) : nullptr;
+	if (!p || p + bytes > end_) {
+		nextChunk(bytes, alignment);
+		p = align_up(ptr_, alignment);
+	}
+	ptr_ = p + bytes;
+	allocations_++;
+	return p;
+}
+
+} /* namespace arena */
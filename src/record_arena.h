@@ -0,0 +1,74 @@
+/*
+ * record_arena.h - bump allocator reset after each parsed record
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_RECORD_ARENA_H_
+#define SRC_RECORD_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace arena {
+
+// Allocation counters summed over all the arenas of the process.
+struct ArenaStats
+{
+	uint64_t records = 0;         // number of arena resets
+	uint64_t allocations = 0;     // allocations served by the arenas
+	uint64_t heapAllocations = 0; // chunks requested from the heap
+	uint64_t heapBytes = 0;
+};
+
+ArenaStats global_arena_stats();
+
+// Memory resource handing out memory from a list of chunks. Deallocation is
+// a no-op, the memory is reclaimed all at once by reset() which keeps the
+// chunks for the next record, so once the arena has grown to the size of
+// the largest record there is no more heap traffic.
+class RecordArena : public std::pmr::memory_resource
+{
+public:
+	explicit RecordArena(size_t chunkSize = 64 * 1024);
+	~RecordArena() override;
+
+	RecordArena(const RecordArena &) = delete;
+	RecordArena &operator=(const RecordArena &) = delete;
+
+	// all the objects allocated from the arena must be destroyed by now
+	void reset();
+
+private:
+	struct Chunk
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	void *do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void *, size_t, size_t) override {}
+	bool do_is_equal(const std::pmr::memory_resource &other) const
+			noexcept override
+	{
+		return this == &other;
+	}
+
+	void nextChunk(size_t bytes, size_t alignment);
+
+	const size_t chunkSize_;
+	std::vector<Chunk> chunks_;
+	size_t current_ = 0;
+	char *ptr_ = nullptr;
+	char *end_ = nullptr;
+	uint64_t allocations_ = 0;
+};
+
+} /* namespace arena */
+
+#endif /* SRC_RECORD_ARENA_H_ */
@@ -0,0 +1,104 @@
+/*
+ * row_stream.cpp - rows of values encoded into the output buffers
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "row_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace row_stream {
+
+namespace {
+
+// the tags of the values
+const char nullTag = 'n';
+const char textTag = 's';
+const char integerTag = 'i';
+
+} // namespace
+
+void begin_row(output::OutputBuffer &out, size_t table)
+{
+	out.append((char) table);
+}
+
+void append_text(output::OutputBuffer &out, std::string_view value)
+{
+	const uint32_t size = (uint32_t) value.size();
+	char *p = out.reserve(5);
+	p[0] = textTag;
+	memcpy(p + 1, &size, 4);
+	out.advance(5);
+	out.append(value);
+}
+
+void append_integer(output::OutputBuffer &out, int64_t value)
+{
+	char *p = out.reserve(9);
+	p[0] = integerTag;
+	memcpy(p + 1, &value, 8);
+	out.advance(9);
+}
+
+void append_null(output::OutputBuffer &out)
+{
+	out.append(nullTag);
+}
+
+RowDecoder::RowDecoder(std::vector<size_t> columnCounts) :
+		columnCounts_(std::move(columnCounts)),
+		values_(*std::max_element(columnCounts_.begin(), columnCounts_.end()))
+{
+}
+
+RowDecoder::Result RowDecoder::decodeRow(const char *&p, const char *end,
+										 size_t &table)
+{
+	const char *q = p;
+	table = (uint8_t) *q++;
+	if (table >= columnCounts_.size()) {
+		return Result::Malformed;
+	}
+
+	for (size_t i = 0; i < columnCounts_[table]; ++i) {
+		if (q == end) {
+			return Result::Incomplete;
+		}
+		Value &value = values_[i];
+		const char tag = *q++;
+		if (tag == nullTag) {
+			value.type = Value::Null;
+		} else if (tag == integerTag) {
+			if (end - q < 8) {
+				return Result::Incomplete;
+			}
+			value.type = Value::Integer;
+			memcpy(&value.integer, q, 8);
+			q += 8;
+		} else if (tag == textTag) {
+			uint32_t size;
+			if (end - q < 4) {
+				return Result::Incomplete;
+			}
+			memcpy(&size, q, 4);
+			q += 4;
+			if ((size_t) (end - q) < size) {
+				return Result::Incomplete;
+			}
+			value.type = Value::Text;
+			value.text = std::string_view(q, size);
+			q += size;
+		} else {
+			return Result::Malformed;
+		}
+	}
+	p = q;
+	return Result::Complete;
+}
+
+} /* namespace row_stream */
@@ -0,0 +1,111 @@
+/*
+ * row_stream.h - rows of values encoded into the output buffers
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_ROW_STREAM_H_
+#define SRC_ROW_STREAM_H_
+
+#include "output_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The records loaded into a database or an archive are encoded as rows into
+// the output buffers, like the text formats, so that the parallel scans put
+// them back in key order, then they are decoded from the buffers handed to
+// a sink. A row is the number of its table followed by a value per column:
+// a null, a string or an integer, each with a tag byte.
+namespace row_stream {
+
+// the row of the table number `table`, then a value for each of its columns
+void begin_row(output::OutputBuffer &out, size_t table);
+void append_text(output::OutputBuffer &out, std::string_view value);
+void append_integer(output::OutputBuffer &out, int64_t value);
+void append_null(output::OutputBuffer &out);
+
+struct Value
+{
+	enum Type {
+		Null,
+		Text,
+		Integer
+	};
+
+	Type type = Null;
+	std::string_view text;
+	int64_t integer = 0;
+};
+
+// Splits the encoded text back into rows, whatever the pieces it is handed
+// over in: what is left of the last row is kept for the next piece.
+class RowDecoder
+{
+public:
+	// the number of columns of each table
+	explicit RowDecoder(std::vector<size_t> columnCounts);
+
+	// Call onRow(table, values) for each row completed by `data`, the values
+	// pointing into the text until it returns. False when a row is
+	// malformed or when onRow() returns false.
+	template <class Function>
+	bool decode(const char *data, size_t size, Function onRow);
+
+	// true when a row was left incomplete
+	bool hasPending() const { return !pending_.empty(); }
+
+private:
+	enum class Result {
+		Complete,
+		Incomplete,
+		Malformed
+	};
+
+	// decode the row at `p` into values_ and move past it when complete
+	Result decodeRow(const char *&p, const char *end, size_t &table);
+
+	std::vector<size_t> columnCounts_;
+	std::vector<Value> values_;
+	std::string pending_; // the start of a row split between two pieces
+};
+
+template <class Function>
+bool RowDecoder::decode(const char *data, size_t size, Function onRow)
+{
+	if (!pending_.empty()) {
+		pending_.append(data, size);
+		data = pending_.data();
+		size = pending_.size();
+	}
+
+	const char *p = data;
+	const char *end = data + size;
+	size_t table;
+	Result result = Result::Complete;
+	while (p != end &&
+		   (result = decodeRow(p, end, table)) == Result::Complete) {
+		if (!onRow(table, values_.data())) {
+			return false;
+		}
+	}
+	if (result == Result::Malformed) {
+		return false;
+	}
+
+	if (data == pending_.data()) {
+		pending_.erase(0, p - data);
+	} else {
+		pending_.assign(p, end);
+	}
+	return true;
+}
+
+} /* namespace row_stream */
+
+#endif /* SRC_ROW_STREAM_H_ */
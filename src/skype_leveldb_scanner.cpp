@@ -6,21 +6,40 @@
  *   Copyright: Use of this source code is governed by a BSD 2-Clause license
  *              that can be found in the LICENSE file.
  */
+#include "arrow_ipc.h"
+#include "bounded_queue.h"
 #include "chromium_leveldb_comparator_provider.h"
+#include "civil_time.h"
+#include "output_buffer.h"
+#include "record_arena.h"
+#include "record_archive.h"
+#include "snappy_decompress.h"
+#include "sqlite_export.h"
 #include "string_encoding_utils.h"
+#include "text_escape.h"
+#include "varint.h"
 
+#include <base/third_party/double_conversion/double-conversion/double-conversion.h>
+#include <leveldb/comparator.h>
 #include <leveldb/db.h>
 #include <leveldb/slice.h>
 
-#include <codecvt>
-#include <iostream>
-#include <locale>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <map>
 #include <memory>
-#include <ostream>
-#include <sstream>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <thread>
 #include <variant>
 #include <vector>
 
+#include <unistd.h>
+
 
 #define PRINT_DEBUG_DETAILS 0
 
@@ -55,32 +74,432 @@ static void printSliceSummary(const leveldb::Slice &slice)
 }
 #endif // PRINT_DEBUG_DETAILS
 
-template <class Function>
-static bool scan_leveldb(const char *dbPath, Function scanFunction)
+// half-open range of keys [start, limit) in the Chromium comparator order
+struct KeyRange
+{
+	std::string start;
+	std::string limit;
+};
+
+static KeyRange object_store_range(int64_t databaseId, int64_t objectStoreId)
+{
+	return {leveldb_view::encode_object_store_data_prefix(databaseId,
+														  objectStoreId),
+			leveldb_view::encode_object_store_data_limit(databaseId,
+														 objectStoreId)};
+}
+
+static std::unique_ptr<leveldb::DB> open_leveldb(const char *dbPath)
 {
 	leveldb::Options options;
 	options.create_if_missing = false;
 	options.comparator = leveldb_view::get_chromium_comparator();
 
-	std::unique_ptr<leveldb::DB> db;
-	{
-		leveldb::DB *tempdb;
-		leveldb::Status status = leveldb::DB::Open(options, dbPath, &tempdb);
-		if (!status.ok()) {
+	leveldb::DB *db = nullptr;
+	leveldb::Status status = leveldb::DB::Open(options, dbPath, &db);
+	if (!status.ok()) {
+		return nullptr;
+	}
+	return std::unique_ptr<leveldb::DB>(db);
+}
+
+template <class Function>
+static bool scan_key_range(leveldb::Iterator *it, const KeyRange &range,
+						   output::OutputBuffer &ostr, Function &scanFunction)
+{
+	const leveldb::Comparator *cmp = leveldb_view::get_chromium_comparator();
+	for (it->Seek(range.start);
+		 it->Valid() && cmp->Compare(it->key(), range.limit) < 0;
+		 it->Next()) {
+		scanFunction(ostr, it->key(), it->value());
+	}
+	return it->status().ok();
+}
+
+// Scan only the given key ranges, in order, so that the table blocks of
+// unrelated object stores are never read from disk. The scan function is
+// called with each record, then its flush() once all of them are formatted.
+template <class Function>
+static bool scan_leveldb(const char *dbPath, const std::vector<KeyRange> &ranges,
+						 output::OutputBuffer &out, Function scanFunction)
+{
+	std::unique_ptr<leveldb::DB> db = open_leveldb(dbPath);
+	if (!db) {
+		return false;
+	}
+
+	std::unique_ptr<leveldb::Iterator> it {
+			db->NewIterator(leveldb::ReadOptions())};
+	for (auto const &range : ranges) {
+		if (!scan_key_range(it.get(), range, out, scanFunction)) {
 			return false;
 		}
-		db.reset(tempdb);
 	}
+	scanFunction.flush(out);
+
+	return true;
+}
+
+// A piece of an object store range starting at the keys which begin with a
+// given string (or with an array key whose first element begins with it).
+struct KeySplit
+{
+	std::string start;
+	std::u16string prefix;
+	bool inArray;
+	bool refinable;
+	uint64_t size;
+};
+
+// characters following the prefix of a split, in the Chromium key order
+static const std::u16string &split_alphabet()
+{
+	static const std::u16string alphabet = [] {
+		std::u16string chars;
+		for (char16_t c = 0x20; c < 0x7f; ++c) {
+			chars += c;
+		}
+		// the rest of the BMP in a few coarse steps
+		for (char16_t c : {0x80, 0x800, 0xd800, 0xe000}) {
+			chars += c;
+		}
+		return chars;
+	}();
+	return alphabet;
+}
+
+static void append_key_splits(std::vector<KeySplit> &splits,
+							  const std::string &keyPrefix,
+							  const std::u16string &prefix, bool inArray)
+{
+	for (char16_t c : split_alphabet()) {
+		std::u16string next = prefix + c;
+		splits.push_back({leveldb_view::encode_string_key(keyPrefix, next,
+														  inArray),
+						  next, inArray, true, 0});
+	}
+}
+
+static uint64_t measure_key_splits(leveldb::DB *db,
+								   std::vector<KeySplit> &splits,
+								   const std::string &limit)
+{
+	std::vector<leveldb::Range> ranges(splits.size());
+	for (size_t i = 0; i < splits.size(); ++i) {
+		ranges[i].start = splits[i].start;
+		ranges[i].limit = (i + 1 < splits.size()) ? splits[i + 1].start : limit;
+	}
+
+	std::vector<uint64_t> sizes(splits.size());
+	db->GetApproximateSizes(ranges.data(), (int) ranges.size(), sizes.data());
 
-	using leveldb::Iterator;
-	using leveldb::ReadOptions;
+	uint64_t total = 0;
+	for (size_t i = 0; i < splits.size(); ++i) {
+		splits[i].size = sizes[i];
+		total += sizes[i];
+	}
+	return total;
+}
 
-	std::unique_ptr<Iterator> it {db->NewIterator(ReadOptions())};
-	for (it->SeekToFirst(); it->Valid(); it->Next()) {
-		scanFunction(it->key(), it->value());
+// Split an object store range (see object_store_range()) into consecutive
+// ranges of about the same size on disk: at most `parts` of them, or more
+// when that makes them smaller than `maxPartSize` bytes. The split keys are
+// synthesized string (and array of string) primary keys, refined one
+// character at a time where the data is dense.
+//
+// The sizes come from GetApproximateSizes(), which only counts the table
+// files. The records still in the memtable, those of a database recovered
+// from its log which didn't fill a write buffer, have no size: such a range
+// isn't split.
+static std::vector<KeyRange> split_key_range(leveldb::DB *db,
+											 const KeyRange &range,
+											 size_t parts, uint64_t maxPartSize)
+{
+	const int maxPrefixLength = 4;
+
+	// numbers and dates sort before strings and strings before arrays
+	std::vector<KeySplit> splits;
+	splits.push_back({range.start, {}, false, false, 0});
+	append_key_splits(splits, range.start, {}, false);
+	append_key_splits(splits, range.start, {}, true);
+
+	uint64_t total = measure_key_splits(db, splits, range.limit);
+	parts = std::max<uint64_t>(parts, total / maxPartSize + 1);
+	if (parts < 2 || total == 0) {
+		return {range};
 	}
 
-	return it->status().ok();
+	for (int depth = 1; depth < maxPrefixLength; ++depth) {
+		const uint64_t target = total / parts;
+		std::vector<KeySplit> refined;
+		bool changed = false;
+		for (auto &split : splits) {
+			if (!split.refinable || split.size <= target / 2) {
+				refined.push_back(std::move(split));
+				continue;
+			}
+			// keys equal to the prefix or followed by a control character
+			refined.push_back({std::move(split.start), split.prefix,
+							   split.inArray, false, 0});
+			append_key_splits(refined, range.start, split.prefix,
+							  split.inArray);
+			changed = true;
+		}
+		splits.swap(refined);
+		if (!changed) {
+			break;
+		}
+		total = measure_key_splits(db, splits, range.limit);
+	}
+
+	std::vector<KeyRange> result;
+	std::string start = range.start;
+	uint64_t accumulated = 0;
+	for (size_t i = 0; i + 1 < splits.size() && result.size() + 1 < parts;
+		 ++i) {
+		accumulated += splits[i].size;
+		if (splits[i].size != 0 &&
+			accumulated * parts >= total * (result.size() + 1)) {
+			result.push_back({start, splits[i + 1].start});
+			start = splits[i + 1].start;
+		}
+	}
+	result.push_back({start, range.limit});
+	return result;
+}
+
+// Scan the given key ranges with a pool of threads, each thread having its
+// own iterator over a shared snapshot. The ranges are split into pieces of
+// about the same size and the output of each piece is buffered, then written
+// in key order so that it is identical to that of scan_leveldb(). The pieces
+// are small and the threads don't start one too far ahead of the piece being
+// written, which bounds the output held in memory when a piece is slow.
+template <class Function>
+static bool scan_leveldb_parallel(const char *dbPath,
+								  const std::vector<KeyRange> &ranges,
+								  unsigned threadCount,
+								  output::OutputBuffer &out,
+								  Function scanFunction)
+{
+	// more pieces than threads, so that a slow piece doesn't stall the others
+	const size_t piecesPerThread = 4;
+	const uint64_t maxPieceSize = 8 << 20; // on disk
+	const size_t maxPiecesAhead = 2 * threadCount;
+
+	std::unique_ptr<leveldb::DB> db = open_leveldb(dbPath);
+	if (!db) {
+		return false;
+	}
+
+	struct Piece
+	{
+		KeyRange range;
+		output::OutputBuffer output;
+		bool done = false;
+		bool ok = false;
+	};
+
+	std::vector<Piece> pieces;
+	for (auto const &range : ranges) {
+		for (auto &subrange : split_key_range(db.get(), range,
+											  threadCount * piecesPerThread,
+											  maxPieceSize)) {
+			pieces.emplace_back();
+			pieces.back().range = std::move(subrange);
+		}
+	}
+
+	const leveldb::Snapshot *snapshot = db->GetSnapshot();
+	std::mutex mutex;
+	std::condition_variable pieceDone;
+	std::condition_variable pieceWritten;
+	size_t piecesWritten = 0;
+	std::atomic<size_t> nextPiece {0};
+
+	auto worker = [&]() {
+		leveldb::ReadOptions readOptions;
+		readOptions.snapshot = snapshot;
+		std::unique_ptr<leveldb::Iterator> it {db->NewIterator(readOptions)};
+		// each thread needs its own copy of the scan function state
+		Function threadScanFunction = scanFunction;
+
+		for (size_t i = nextPiece++; i < pieces.size(); i = nextPiece++) {
+			{
+				// the pieces are taken in order, the one being written never
+				// waits
+				std::unique_lock<std::mutex> lock(mutex);
+				pieceWritten.wait(lock, [&] {
+					return i < piecesWritten + maxPiecesAhead;
+				});
+			}
+			Piece &piece = pieces[i];
+			const bool ok = scan_key_range(it.get(), piece.range, piece.output,
+										   threadScanFunction);
+			threadScanFunction.flush(piece.output);
+			std::lock_guard<std::mutex> lock(mutex);
+			piece.ok = ok;
+			piece.done = true;
+			pieceDone.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < threadCount; ++i) {
+		threads.emplace_back(worker);
+	}
+
+	bool ok = true;
+	for (auto &piece : pieces) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			pieceDone.wait(lock, [&piece] { return piece.done; });
+		}
+		out.append(piece.output.data(), piece.output.size());
+		piece.output = output::OutputBuffer();
+		ok = ok && piece.ok;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			piecesWritten++;
+		}
+		pieceWritten.notify_all();
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	db->ReleaseSnapshot(snapshot);
+	return ok;
+}
+
+// records copied out of the iterator, keys and values stored back to back
+struct RecordBatch
+{
+	size_t sequence = 0;
+	std::string bytes;
+	std::vector<std::pair<size_t, size_t>> sizes;
+};
+
+struct FormattedBatch
+{
+	size_t sequence = 0;
+	output::OutputBuffer text;
+};
+
+// Scan the given key ranges as a pipeline: a reader thread only copies
+// batches of records out of the iterator, a pool of worker threads parses
+// and formats them and the calling thread writes the results back in key
+// order. The bounded queues between the stages, and a limit on the number
+// of batches in flight, keep the reader from running ahead of the writer.
+// A stage with nothing to do sleeps until the stage it waits on wakes it.
+template <class Function>
+static bool scan_leveldb_pipeline(const char *dbPath,
+								  const std::vector<KeyRange> &ranges,
+								  unsigned workerCount,
+								  output::OutputBuffer &out,
+								  Function scanFunction)
+{
+	const size_t batchBytes = 256 * 1024;
+	const size_t queueCapacity = 4 * workerCount;
+	const size_t maxBatchesInFlight = 4 * queueCapacity;
+
+	std::unique_ptr<leveldb::DB> db = open_leveldb(dbPath);
+	if (!db) {
+		return false;
+	}
+
+	lockfree::BoundedQueue<RecordBatch> records(queueCapacity);
+	lockfree::BoundedQueue<FormattedBatch> results(queueCapacity);
+	std::atomic<size_t> batchesWritten {0};
+	lockfree::Signal batchWritten;
+	// the last worker to finish closes the results
+	std::atomic<unsigned> workersLeft {workerCount};
+	bool readOk = true;
+
+	std::thread reader([&]() {
+		std::unique_ptr<leveldb::Iterator> it {
+				db->NewIterator(leveldb::ReadOptions())};
+		const leveldb::Comparator *cmp = leveldb_view::get_chromium_comparator();
+		size_t sequence = 0;
+		RecordBatch batch;
+
+		auto flush = [&]() {
+			batchWritten.wait([&] {
+				return sequence - batchesWritten.load(
+						std::memory_order_acquire) < maxBatchesInFlight;
+			});
+			batch.sequence = sequence++;
+			records.push(std::move(batch));
+			batch = RecordBatch();
+		};
+
+		for (auto const &range : ranges) {
+			for (it->Seek(range.start);
+				 it->Valid() && cmp->Compare(it->key(), range.limit) < 0;
+				 it->Next()) {
+				const leveldb::Slice key = it->key();
+				const leveldb::Slice value = it->value();
+				batch.bytes.append(key.data(), key.size());
+				batch.bytes.append(value.data(), value.size());
+				batch.sizes.emplace_back(key.size(), value.size());
+				if (batch.bytes.size() >= batchBytes) {
+					flush();
+				}
+			}
+			if (!it->status().ok()) {
+				readOk = false;
+				break;
+			}
+		}
+		if (!batch.sizes.empty()) {
+			flush();
+		}
+		records.close();
+	});
+
+	auto worker = [&]() {
+		// each thread needs its own copy of the scan function state
+		Function threadScanFunction = scanFunction;
+		RecordBatch batch;
+		while (records.pop(batch)) {
+			output::OutputBuffer ostr;
+			const char *p = batch.bytes.data();
+			for (auto const &[keySize, valueSize] : batch.sizes) {
+				threadScanFunction(ostr, leveldb::Slice(p, keySize),
+								   leveldb::Slice(p + keySize, valueSize));
+				p += keySize + valueSize;
+			}
+			threadScanFunction.flush(ostr);
+			results.push(FormattedBatch {batch.sequence, std::move(ostr)});
+		}
+		if (--workersLeft == 0) {
+			results.close();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < workerCount; ++i) {
+		workers.emplace_back(worker);
+	}
+
+	// batches may complete out of order, keep them until their turn comes
+	std::map<size_t, output::OutputBuffer> pending;
+	size_t next = 0;
+	FormattedBatch result;
+	while (results.pop(result)) {
+		pending.emplace(result.sequence, std::move(result.text));
+		for (auto i = pending.begin();
+			 i != pending.end() && i->first == next; i = pending.erase(i)) {
+			out.append(i->second.data(), i->second.size());
+			batchesWritten.store(++next, std::memory_order_release);
+			batchWritten.notify();
+		}
+	}
+
+	reader.join();
+	for (auto &thread : workers) {
+		thread.join();
+	}
+	return readOk;
 }
 
 namespace parse_result {
@@ -88,27 +507,191 @@ namespace parse_result {
 struct Unit : std::monostate {};
 
 // ValueSentinel is used to signal the end of parsing of an object or of an array
-struct ValueSentinel {};
+struct ValueSentinel
+{
+	uint8_t tag = 0; // the closing tag, '{', '$' or '@'
+};
+
+// a JavaScript Date, in milliseconds since the epoch
+struct Date
+{
+	double ms = 0;
+};
+
+// a reference to an object serialized earlier in the same value, by the
+// order in which the objects appear
+struct ObjectRef
+{
+	uint64_t id = 0;
+};
+
+// A string left in its serialized form inside the LevelDB value, it is only
+// converted to UTF-8 when a consumer asks for it. It must not outlive the
+// slice it was parsed from.
+struct StringRef
+{
+	enum Encoding { Latin1, Utf16, Utf8 };
+
+	const uint8_t *data = nullptr;
+	size_t size = 0; // in bytes
+	Encoding encoding = Latin1;
+
+	bool isAscii() const
+	{
+		if (encoding == Utf16) {
+			return false;
+		}
+		for (size_t i = 0; i < size; ++i) {
+			if (data[i] >= 0x80) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// compare against an ASCII string without converting
+	bool equals(std::string_view ascii) const
+	{
+		if (encoding != Utf16) {
+			return size == ascii.size() &&
+					memcmp(data, ascii.data(), size) == 0;
+		}
+		if (size != ascii.size() * sizeof(char16_t)) {
+			return false;
+		}
+		for (size_t i = 0; i < ascii.size(); ++i) {
+			// UTF-16LE
+			if (data[2 * i] != (uint8_t) ascii[i] || data[2 * i + 1] != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// append the string converted to UTF-8
+	void appendTo(std::string &result) const
+	{
+		if (encoding == Latin1) {
+			cp::append_iso8859_as_utf8(data, size, result);
+		} else if (encoding == Utf8) {
+			result.append(reinterpret_cast<const char *>(data), size);
+		} else {
+			cp::append_utf16le_as_utf8(data, size, result);
+		}
+	}
+
+	std::string str() const
+	{
+		if (encoding == Latin1) {
+			return cp::convert_iso8859_to_utf8(data, size);
+		}
+		if (encoding == Utf8) {
+			return std::string(reinterpret_cast<const char *>(data), size);
+		}
+		return cp::convert_utf16le_to_utf8(data, size);
+	}
+};
+
+// Write a number as JavaScript does, in the shortest form which reads back
+// as the same double.
+static output::OutputBuffer &writeNumber(output::OutputBuffer &ostr,
+										 double v)
+{
+	char buffer[32];
+	double_conversion::StringBuilder builder(buffer, sizeof(buffer));
+	double_conversion::DoubleToStringConverter::EcmaScriptConverter()
+			.ToShortest(v, &builder);
+	const int length = builder.position();
+	builder.Finalize();
+	ostr.append(buffer, length);
+	return ostr;
+}
+
+static output::OutputBuffer &operator<<(output::OutputBuffer &ostr,
+										const StringRef &s)
+{
+	if (s.encoding == StringRef::Utf8 || s.isAscii()) {
+		ostr.append(reinterpret_cast<const char *>(s.data), s.size);
+		return ostr;
+	}
+	// converted in a buffer reused by the records formatted by the thread
+	static thread_local std::string converted;
+	converted.clear();
+	s.appendTo(converted);
+	return ostr << converted;
+}
+
+// A BigInt: the magnitude as little endian bytes, left in the input.
+struct BigIntRef
+{
+	const uint8_t *digits = nullptr;
+	size_t size = 0;
+	bool negative = false;
+};
+
+// An ArrayBuffer, or a view of one when `viewTag` is set to the V8 view
+// subtag ('B' for Uint8Array, 'd' for Float64Array...), left in the input.
+struct BinaryRef
+{
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	uint8_t viewTag = 0;
+	uint64_t viewOffset = 0;
+	uint64_t viewLength = 0;
+};
+
+// The containers of a Value tree are allocated from this memory resource,
+// which the scan callbacks point to a per-thread arena reset after each
+// record.
+static thread_local std::pmr::memory_resource *valueResource =
+		std::pmr::new_delete_resource();
+
+// Deleter for the containers of a Value, they give their memory back to the
+// resource they were allocated from.
+struct ResourceDelete
+{
+	template <class T>
+	void operator()(T *p) const
+	{
+		std::pmr::memory_resource *resource = p->get_allocator().resource();
+		p->~T();
+		resource->deallocate(p, sizeof(T), alignof(T));
+	}
+};
 
 class Value
 {
 public:
-	using KeyValuePairs = std::vector<std::pair<std::string, Value>>;
-	using Values = std::vector<Value>;
-	using ValuePairs = std::vector<std::pair<Value, Value>>;
+	using KeyValuePairs = std::pmr::vector<std::pair<StringRef, Value>>;
+	using Values = std::pmr::vector<Value>;
+	using ValuePairs = std::pmr::vector<std::pair<Value, Value>>;
 
 	// we have to use reference semantics because we can't store a Value by
 	// value inside a Value.
-	using KeyValuePairsPtr = std::unique_ptr<KeyValuePairs>;
-	using ValuesPtr = std::unique_ptr<Values>;
-	using ValuePairsPtr = std::unique_ptr<ValuePairs>;
+	using KeyValuePairsPtr = std::unique_ptr<KeyValuePairs, ResourceDelete>;
+	using ValuesPtr = std::unique_ptr<Values, ResourceDelete>;
+	using ValuePairsPtr = std::unique_ptr<ValuePairs, ResourceDelete>;
+
+	template <class T>
+	static std::unique_ptr<T, ResourceDelete> makeContainer()
+	{
+		std::pmr::memory_resource *resource = valueResource;
+		void *p = resource->allocate(sizeof(T), alignof(T));
+		return std::unique_ptr<T, ResourceDelete>(new (p) T(resource));
+	}
 
 	using Variant = std::variant<
 						Unit,
 						bool,
 						int,
 						uint64_t,
+						double,
 						std::string,
+						StringRef,
+						Date,
+						BigIntRef,
+						BinaryRef,
+						ObjectRef,
 						KeyValuePairsPtr,
 						ValuesPtr,
 						ValuePairsPtr,
@@ -127,10 +710,10 @@ public:
 
 struct Visitor
 {
-	std::ostream &ostr_;
+	output::OutputBuffer &ostr_;
 	int indent_ = 0;
 
-	Visitor(std::ostream &ostr) :
+	Visitor(output::OutputBuffer &ostr) :
 			ostr_(ostr), indent_(0)
 	{
 	}
@@ -154,10 +737,60 @@ struct Visitor
 		ostr_ << v;
 	}
 
+	void operator()(double v) const {
+		writeNumber(ostr_, v);
+	}
+
+	void operator()(const Date &v) const {
+		const time_t t = (time_t) std::floor(v.ms / 1000);
+		struct tm parts = {};
+		gmtime_r(&t, &parts);
+		char buffer[80];
+		snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+				 parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
+				 parts.tm_hour, parts.tm_min, parts.tm_sec,
+				 (int) (v.ms - (double) t * 1000));
+		ostr_ << buffer;
+	}
+
+	void operator()(const BigIntRef &v) const {
+		// hexadecimal, most significant digit first
+		static const char hexDigits[] = "0123456789abcdef";
+		ostr_ << (v.negative ? "-0x" : "0x");
+		size_t n = v.size;
+		while (n > 1 && v.digits[n - 1] == 0) {
+			n--;
+		}
+		if (n == 0) {
+			ostr_ << '0';
+		}
+		for (size_t i = n; i-- > 0;) {
+			ostr_ << hexDigits[v.digits[i] >> 4] << hexDigits[v.digits[i] & 15];
+		}
+		ostr_ << 'n';
+	}
+
+	void operator()(const BinaryRef &v) const {
+		if (v.viewTag) {
+			ostr_ << "ArrayBufferView(" << (char) v.viewTag << ", " << v.viewOffset
+				  << ", " << v.viewLength << ')';
+		} else {
+			ostr_ << "ArrayBuffer(" << v.size << ')';
+		}
+	}
+
+	void operator()(const ObjectRef &v) const {
+		ostr_ << "Ref(" << v.id << ')';
+	}
+
 	void operator()(const std::string &v) const {
 		ostr_ << v;
 	}
 
+	void operator()(const StringRef &v) const {
+		ostr_ << v;
+	}
+
 	void operator()(Unit) const {
 		ostr_ << "Null";
 	}
@@ -190,9 +823,12 @@ struct Visitor
 	}
 
 	void operator()(const Value::ValuePairsPtr &ps) {
+		ostr_ << '\n';
 		indent_++;
 		for (auto &[k, v] : *ps.get()) {
 			indent();
+			std::visit(*this, k.vt_);
+			ostr_ << '=';
 			std::visit(*this, v.vt_);
 			ostr_ << '\n';
 		}
@@ -200,6 +836,74 @@ struct Visitor
 	}
 };
 
+// Make the Value trees parsed in this scope use the given arena, which is
+// reset on exit. The trees must be destroyed before leaving the scope.
+class ArenaScope
+{
+public:
+	explicit ArenaScope(arena::RecordArena &recordArena) :
+			arena_(recordArena), previous_(valueResource)
+	{
+		valueResource = &arena_;
+	}
+
+	~ArenaScope()
+	{
+		valueResource = previous_;
+		arena_.reset();
+	}
+
+	ArenaScope(const ArenaScope &) = delete;
+	ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+	arena::RecordArena &arena_;
+	std::pmr::memory_resource *previous_;
+};
+
+// why a record could not be decoded
+enum class ParseError {
+	None,
+	Truncated,    // a length or a value runs past the end of the record
+	BadVarInt,    // truncated varint or one longer than 64 bits
+	UnknownTag,
+	BadStructure, // misplaced closing tag or key
+	BadHeader,    // unexpected bytes before the serialized value
+	TooDeep,      // objects and arrays nested deeper than allowed
+	UnsupportedVersion,
+	BadCompression,
+	ExternalValue, // the value is kept in a blob file, outside of LevelDB
+	Count
+};
+
+static const char *const parseErrorNames[] = {
+	"none",
+	"truncated",
+	"bad varint",
+	"unknown tag",
+	"bad structure",
+	"bad header",
+	"too deep",
+	"unsupported version",
+	"bad compression",
+	"value in a blob file"
+};
+
+// The result of a parser: a value, or the reason the input couldn't be
+// decoded, in which case `value` is left default constructed.
+template <class T>
+struct ParseResult
+{
+	T value {};
+	ParseError error = ParseError::None;
+
+	ParseResult(T &&v) : value(std::move(v)) {}
+	ParseResult(const T &v) : value(v) {}
+	ParseResult(ParseError e) : error(e) {}
+
+	explicit operator bool() const { return error == ParseError::None; }
+};
+
 } // namespace parse_result
 
 namespace parsers {
@@ -215,416 +919,1998 @@ using Parser = std::optional<std::pair<Result, State>>(*)(State);
 } // namespace new_parsers
 #endif
 
-static size_t parseVarInt(const uint8_t **p, const uint8_t *const pend)
+// version of the V8 serialization format written by the Chromium embedded in
+// Skype, unless the value starts with a version tag
+static const uint32_t defaultV8Version = 13;
+
+// One item of the V8 serialization format: a primitive value, or the
+// beginning or the end of an object, an array, a Map or a Set.
+struct V8Item
 {
-	const uint8_t *i = *p;
-	if ((*i & 0x80) == 0) {
-		(*p)++;
-		return *i;
-	}
+	enum Kind : uint8_t {
+		Padding, // padding, version and object count tags, no value
+		Null,    // null, undefined or an array hole
+		Bool,
+		Int,
+		Uint,
+		Double,
+		Date,
+		BigInt,
+		String,
+		Reference,
+		RegExp,
+		Binary,
+		Error,
+		// each end kind follows its begin kind
+		BeginObject,
+		EndObject,
+		BeginDenseArray,
+		EndDenseArray,
+		BeginSparseArray,
+		EndSparseArray,
+		BeginMap,
+		EndMap,
+		BeginSet,
+		EndSet
+	};
 
-	int count = 0;
-	uint8_t buf[8] = {};
-	while (*i & 0x80 && i != pend && count < (int) sizeof(buf)) {
-		buf[count++] = *i & 0x7fu;
-		i++;
+	Kind kind = Padding;
+	int32_t int32 = 0;
+	// Bool, Uint, Reference id, RegExp flags, array length
+	uint64_t uint = 0;
+	double number = 0;    // Double, Date
+	StringRef string;     // String, RegExp pattern, Error message
+	BigIntRef bigInt;
+	BinaryRef binary;
+	uint8_t errorTag = 0; // prototype of an Error, 'R' for RangeError...
+
+	bool isBegin() const
+	{
+		return kind >= BeginObject && ((kind - BeginObject) & 1) == 0;
 	}
-
-	buf[count++] = *i & 0x7fu;
-	i++;
-
-	size_t res = 0;
-	assert(count > 0);
-	for (; count >= 0; count--) {
-		res <<= 7;
-		res |= buf[count];
+	bool isEnd() const
+	{
+		return kind >= BeginObject && ((kind - BeginObject) & 1) != 0;
 	}
-	*p = i;
-	return res;
-}
+};
 
-static Value parseString(const uint8_t **p, const uint8_t *const pend)
+// the input of the tag decoders
+struct V8Reader
 {
-	const uint8_t *i = *p;
-	// expect *i == '"'
-	assert(*i == '"');
-	i++;
+	const uint8_t *p;
+	const uint8_t *pend;
+	uint32_t version = defaultV8Version;
+};
 
-	const size_t len = parseVarInt(&i, pend);
-	auto result = cp::convert_iso8859_to_utf8(i, len);
-	i += len;
-	*p = i;
-	return Value(result);
-}
+// Decode what follows `tag`, r.p points past the tag.
+using TagDecoder = ParseError (*)(V8Reader &r, uint8_t tag, V8Item &item);
 
-static Value parseUtf16String(const uint8_t **p, const uint8_t *const pend)
+static ParseError readVarInt(V8Reader &r, uint64_t &value)
 {
-	const uint8_t *i = *p;
-	// expect *i == 'c'
-	assert(*i == 'c');
-	i++;
-
-	const size_t len = parseVarInt(&i, pend);
-
-	auto stringData = reinterpret_cast<const char16_t*>(i);
-	i += len;
-	*p = i;
-	return Value(std::wstring_convert<
-			std::codecvt_utf8_utf16<char16_t>, char16_t>().to_bytes(
-			stringData, stringData + len / sizeof(char16_t)));
+	return varint::decode(&r.p, r.pend, &value) ? ParseError::None :
+			ParseError::BadVarInt;
 }
 
-static Value parse64BitInt(const uint8_t **p, const uint8_t *const pend)
+static ParseError decodeUnknown(V8Reader &, uint8_t, V8Item &)
 {
-	const uint8_t *i = *p;
-	// expect *i == 'N'
-	assert(*i == 'N');
-	i++;
-
-	uint64_t result;
-	memcpy(&result, i, 8);
-	i += 8;
-	*p = i;
-	return Value(result);
+	return ParseError::UnknownTag;
 }
 
-static Value parseInt(const uint8_t **p, const uint8_t *const pend)
+static ParseError decodePadding(V8Reader &, uint8_t, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == '"'
-	assert(*i == 'I');
-	i++;
-
-	// TODO: what about signed integers?
-	int result = (int) parseVarInt(&i, pend);
-	*p = i;
-	return Value(result);
+	item.kind = V8Item::Padding;
+	return ParseError::None;
 }
 
-static Value parseNull(const uint8_t **p, const uint8_t *const pend)
+static ParseError decodeVersion(V8Reader &r, uint8_t, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == '_'
-	// I don't know what the '0' stands for, so consider it the same as null
-	assert(*i == '_' || *i == '0');
-	*p = i + 1;
-	return Value();
+	uint64_t version = 0;
+	const ParseError error = readVarInt(r, version);
+	r.version = (uint32_t) version;
+	item.kind = V8Item::Padding;
+	return error;
 }
 
-static Value parseBool(const uint8_t **p, const uint8_t *const pend)
+// '?' checks the number of objects deserialized so far
+static ParseError decodeObjectCount(V8Reader &r, uint8_t, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == 'F' or 'T'
-	assert(*i == 'F' || *i == 'T');
-	bool result = *i == 'T';
-	i++;
-	*p = i;
-	return Value(result);
+	uint64_t count;
+	item.kind = V8Item::Padding;
+	return readVarInt(r, count);
 }
 
-static Value parseArrayClosingTag(const uint8_t **p, const uint8_t *const pend)
+// '0' is null, '_' undefined and '-' the hole of a sparse array, all of
+// them shown as null
+static ParseError decodeNull(V8Reader &, uint8_t, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == '$'
-	assert(*i == '$');
-	i++;
-	assert(*i == '\x00');
-	i += 2;
-	*p = i;
-	return Value(ValueSentinel());
+	item.kind = V8Item::Null;
+	return ParseError::None;
 }
 
-static Value parseArray2ClosingTag(const uint8_t **p, const uint8_t *const pend)
+// 'T' and 'F', or the Boolean objects 'y' and 'x'
+static ParseError decodeBool(V8Reader &, uint8_t tag, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == '@'
-	assert(*i == '@');
-	i += 3;
-	*p = i;
-	return Value(ValueSentinel());
+	item.kind = V8Item::Bool;
+	item.uint = (tag == 'T' || tag == 'y');
+	return ParseError::None;
 }
 
-static Value parseObjectClosingTag(const uint8_t **p, const uint8_t *const pend)
+static ParseError decodeInt32(V8Reader &r, uint8_t, V8Item &item)
 {
-	const uint8_t *i = *p;
-	// expect *i == '{'
-	assert(*i == '{');
-	i += 2;
-	*p = i;
-	return Value(ValueSentinel());
+	uint64_t zigzag = 0;
+	const ParseError error = readVarInt(r, zigzag);
+	item.kind = V8Item::Int;
+	item.int32 = (int32_t) ((uint32_t) (zigzag >> 1) ^ -(uint32_t) (zigzag & 1));
+	return error;
 }
 
-// forward declaration
-static Value parseObject(const uint8_t **p, const uint8_t *const pend);
-static Value parseArray(const uint8_t **p, const uint8_t *const pend);
-static Value parseArray2(const uint8_t **p, const uint8_t *const pend);
-static Value parseKey(const uint8_t **p, const uint8_t *const pend);
+static ParseError decodeUint32(V8Reader &r, uint8_t, V8Item &item)
+{
+	item.kind = V8Item::Uint;
+	return readVarInt(r, item.uint);
+}
 
-static Value parseVal(const uint8_t **p, const uint8_t *const pend)
+// 'N', the Number object 'n' and the Date 'D' are all doubles
+static ParseError decodeDouble(V8Reader &r, uint8_t tag, V8Item &item)
 {
-	uint8_t tag = **p;
-	if (tag == '\0' || tag == '\x01') {
-		// sometimes added for padding, skip it
-		(*p)++;
-		tag = **p;
+	if (r.pend - r.p < 8) {
+		return ParseError::Truncated;
 	}
+	memcpy(&item.number, r.p, 8);
+	r.p += 8;
+	item.kind = tag == 'D' ? V8Item::Date : V8Item::Double;
+	return ParseError::None;
+}
 
-	switch (tag) {
-	case '"':
-		return parseString(p, pend);
-	case 'c':
-		return parseUtf16String(p, pend);
-	case 'N':
-		return parse64BitInt(p, pend);
-	case '_':
-	case '0':
-		return parseNull(p, pend);
-	case 'F':
-	case 'T':
-		return parseBool(p, pend);
-	case 'o':
-		return parseObject(p, pend);
-	case 'A':
-		return parseArray(p, pend);
-	case 'a':
-		return parseArray2(p, pend);
-	case '$':
-		return parseArrayClosingTag(p, pend);
-	case '@':
-		return parseArray2ClosingTag(p, pend);
-	case '{':
-		return parseObjectClosingTag(p, pend);
-	case 'I':
-		return parseInt(p, pend);
-	default:
-		assert(false);
-		break;
+// 'Z', or the BigInt object 'z': the sign in bit 0 and the number of bytes
+// in the following bits, then the magnitude
+static ParseError decodeBigInt(V8Reader &r, uint8_t, V8Item &item)
+{
+	uint64_t bitfield;
+	const ParseError error = readVarInt(r, bitfield);
+	if (error != ParseError::None) {
+		return error;
+	}
+	const uint64_t size = (bitfield >> 1) & 0x3fffffff;
+	if (size > (uint64_t) (r.pend - r.p)) {
+		return ParseError::Truncated;
 	}
+	item.kind = V8Item::BigInt;
+	item.bigInt = {r.p, (size_t) size, (bitfield & 1) != 0};
+	r.p += size;
+	return ParseError::None;
 }
 
-static Value parseKey(const uint8_t **p, const uint8_t *const pend)
+// the length prefixed string following the '"', 'c' or 'S' tag
+static ParseError decodeString(V8Reader &r, uint8_t tag, V8Item &item)
 {
-	// returned object should be either string or object terminator sentinel
-	return parseVal(p, pend);
+	uint64_t len;
+	const ParseError error = readVarInt(r, len);
+	if (error != ParseError::None) {
+		return error;
+	}
+	if (len > (uint64_t) (r.pend - r.p)) {
+		return ParseError::Truncated;
+	}
+	item.kind = V8Item::String;
+	item.string = {r.p, (size_t) len, tag == '"' ? StringRef::Latin1 :
+			tag == 'c' ? StringRef::Utf16 : StringRef::Utf8};
+	r.p += len;
+	return ParseError::None;
 }
 
-static Value parseObject(const uint8_t **p, const uint8_t *const pend)
+// a string with its own tag, as found in String objects, RegExps and Errors
+static ParseError decodeTaggedString(V8Reader &r, V8Item &item)
 {
-	// expect **p == 'o'
-	assert(**p == 'o');
-	(*p)++;
-
-	Value result(std::make_unique<Value::KeyValuePairs>());
-	Value k;
-	Value v;
-
-	Value::KeyValuePairs *ps = std::get<Value::KeyValuePairsPtr>(result.vt_).get();
-	while (true) {
-		k = parseKey(p, pend);
-		if (!std::holds_alternative<std::string>(k.vt_)) {
-			break;
-		}
-		v = parseVal(p, pend);
-		ps->emplace_back(std::move(std::get<std::string>(k.vt_)), std::move(v));
+	if (r.p >= r.pend) {
+		return ParseError::Truncated;
 	}
-	return result;
+	const uint8_t tag = *r.p++;
+	if (tag != '"' && tag != 'c' && tag != 'S') {
+		return ParseError::BadStructure;
+	}
+	return decodeString(r, tag, item);
 }
 
-static Value parseArray(const uint8_t **p, const uint8_t *const pend)
+static ParseError decodeStringObject(V8Reader &r, uint8_t, V8Item &item)
 {
-	// expect **p == 'o'
-	assert(**p == 'A');
-	(*p)++;
-
-	const size_t len = parseVarInt(p, pend);
+	return decodeTaggedString(r, item);
+}
 
-	Value result(std::make_unique<Value::Values>());
-	Value::Values *vs = std::get<Value::ValuesPtr>(result.vt_).get();
+// '^' refers to an object seen before in the value, the transferred objects
+// 't', 'u', 'w' and 'p' to objects outside of it, by their index
+static ParseError decodeReference(V8Reader &r, uint8_t, V8Item &item)
+{
+	item.kind = V8Item::Reference;
+	return readVarInt(r, item.uint);
+}
 
-	for (size_t i = 0; i < len; ++i) {
-		vs->emplace_back(parseVal(p, pend));
+static ParseError decodeRegExp(V8Reader &r, uint8_t, V8Item &item)
+{
+	const ParseError error = decodeTaggedString(r, item);
+	if (error != ParseError::None) {
+		return error;
 	}
-
-	parseVal(p, pend); // discard array terminator
-	return result;
+	item.kind = V8Item::RegExp;
+	return readVarInt(r, item.uint);
 }
 
-static Value parseArray2(const uint8_t **p, const uint8_t *const pend)
+// 'B', or the resizable '~' with its maximum length, possibly followed by a
+// view of the buffer which is then the value
+static ParseError decodeArrayBuffer(V8Reader &r, uint8_t tag, V8Item &item)
 {
-	// expect **p == 'o'
-	assert(**p == 'a');
-	(*p)++;
-
-	const size_t len = parseVarInt(p, pend);
-
-	Value result(std::make_unique<Value::ValuePairs>());
-	Value::ValuePairs *ps = std::get<Value::ValuePairsPtr>(result.vt_).get();
-
-	Value v1;
-	for (size_t i = 0; i < len; ++i) {
-		v1 = parseVal(p, pend);
-		ps->emplace_back(std::move(v1), parseVal(p, pend));
+	uint64_t size, maxSize;
+	ParseError error = readVarInt(r, size);
+	if (error == ParseError::None && tag == '~') {
+		error = readVarInt(r, maxSize);
+	}
+	if (error != ParseError::None) {
+		return error;
 	}
+	if (size > (uint64_t) (r.pend - r.p)) {
+		return ParseError::Truncated;
+	}
+	item.kind = V8Item::Binary;
+	item.binary = {r.p, (size_t) size};
+	r.p += size;
 
-	parseVal(p, pend); // discard array terminator
-	return result;
+	if (r.p == r.pend || *r.p != 'V') {
+		return ParseError::None;
+	}
+	r.p++;
+	if (r.p == r.pend) {
+		return ParseError::Truncated;
+	}
+	item.binary.viewTag = *r.p++;
+	error = readVarInt(r, item.binary.viewOffset);
+	if (error == ParseError::None) {
+		error = readVarInt(r, item.binary.viewLength);
+	}
+	if (error == ParseError::None && r.version >= 14) {
+		uint64_t flags;
+		error = readVarInt(r, flags);
+	}
+	return error;
+}
+
+// 'r' is followed by subtags: the prototype, the message and the stack,
+// up to '.'
+static ParseError decodeError(V8Reader &r, uint8_t, V8Item &item)
+{
+	uint8_t errorTag = 0;
+	StringRef message;
+	while (true) {
+		if (r.p >= r.pend) {
+			return ParseError::Truncated;
+		}
+		const uint8_t subtag = *r.p++;
+		if (subtag == '.') {
+			break;
+		}
+		switch (subtag) {
+		case 'E':
+		case 'R':
+		case 'F':
+		case 'S':
+		case 'T':
+		case 'U':
+			errorTag = subtag;
+			break;
+		case 'm':
+		case 's': {
+			const ParseError error = decodeTaggedString(r, item);
+			if (error != ParseError::None) {
+				return error;
+			}
+			if (subtag == 'm') {
+				message = item.string;
+			}
+			break;
+		}
+		default:
+			// the cause 'c' is a whole value, not supported
+			return ParseError::UnknownTag;
+		}
+	}
+	item.kind = V8Item::Error;
+	item.errorTag = errorTag;
+	item.string = message;
+	return ParseError::None;
+}
+
+static ParseError decodeBegin(V8Reader &r, uint8_t tag, V8Item &item)
+{
+	switch (tag) {
+	case 'o':
+		item.kind = V8Item::BeginObject;
+		return ParseError::None;
+	case 'A':
+		item.kind = V8Item::BeginDenseArray;
+		return readVarInt(r, item.uint);
+	case 'a':
+		item.kind = V8Item::BeginSparseArray;
+		return readVarInt(r, item.uint);
+	case ';':
+		item.kind = V8Item::BeginMap;
+		return ParseError::None;
+	default:
+		item.kind = V8Item::BeginSet;
+		return ParseError::None;
+	}
+}
+
+// '{' is followed by the number of properties, '$' and '@' by the number of
+// properties and the length of the array, ':' and ',' by the number of
+// values read
+static ParseError decodeEnd(V8Reader &r, uint8_t tag, V8Item &item)
+{
+	uint64_t count;
+	ParseError error = readVarInt(r, count);
+	switch (tag) {
+	case '{':
+		item.kind = V8Item::EndObject;
+		return error;
+	case '$':
+		item.kind = V8Item::EndDenseArray;
+		break;
+	case '@':
+		item.kind = V8Item::EndSparseArray;
+		break;
+	case ':':
+		item.kind = V8Item::EndMap;
+		return error;
+	default:
+		item.kind = V8Item::EndSet;
+		return error;
+	}
+	if (error == ParseError::None) {
+		error = readVarInt(r, count);
+	}
+	return error;
+}
+
+// the decoder of every tag of the V8 ValueSerializer, host objects ('\\')
+// written by Blink aren't supported
+struct TagTable
+{
+	TagDecoder decoders[256];
+
+	constexpr TagTable() : decoders()
+	{
+		for (auto &decoder : decoders) {
+			decoder = decodeUnknown;
+		}
+		decoders['\0'] = decodePadding;
+		// seen before the values, keep skipping it
+		decoders['\x01'] = decodePadding;
+		decoders[0xff] = decodeVersion;
+		decoders['?'] = decodeObjectCount;
+		decoders['_'] = decodeNull;
+		decoders['0'] = decodeNull;
+		decoders['-'] = decodeNull;
+		decoders['T'] = decodeBool;
+		decoders['F'] = decodeBool;
+		decoders['y'] = decodeBool;
+		decoders['x'] = decodeBool;
+		decoders['I'] = decodeInt32;
+		decoders['U'] = decodeUint32;
+		decoders['N'] = decodeDouble;
+		decoders['n'] = decodeDouble;
+		decoders['D'] = decodeDouble;
+		decoders['Z'] = decodeBigInt;
+		decoders['z'] = decodeBigInt;
+		decoders['"'] = decodeString;
+		decoders['c'] = decodeString;
+		decoders['S'] = decodeString;
+		decoders['s'] = decodeStringObject;
+		decoders['^'] = decodeReference;
+		decoders['t'] = decodeReference;
+		decoders['u'] = decodeReference;
+		decoders['w'] = decodeReference;
+		decoders['p'] = decodeReference;
+		decoders['R'] = decodeRegExp;
+		decoders['B'] = decodeArrayBuffer;
+		decoders['~'] = decodeArrayBuffer;
+		decoders['r'] = decodeError;
+		decoders['o'] = decodeBegin;
+		decoders['A'] = decodeBegin;
+		decoders['a'] = decodeBegin;
+		decoders[';'] = decodeBegin;
+		decoders['\''] = decodeBegin;
+		decoders['{'] = decodeEnd;
+		decoders['$'] = decodeEnd;
+		decoders['@'] = decodeEnd;
+		decoders[':'] = decodeEnd;
+		decoders[','] = decodeEnd;
+	}
+};
+
+static constexpr TagTable tagTable;
+
+// decode the next item, which may be Padding
+static inline ParseError decodeItem(V8Reader &r, V8Item &item)
+{
+	const uint8_t tag = *r.p++;
+	return tagTable.decoders[tag](r, tag, item);
+}
+
+// decode the next item other than Padding
+static ParseError readItem(V8Reader &r, V8Item &item)
+{
+	do {
+		if (r.p >= r.pend) {
+			return ParseError::Truncated;
+		}
+		const ParseError error = decodeItem(r, item);
+		if (error != ParseError::None) {
+			return error;
+		}
+	} while (item.kind == V8Item::Padding);
+	return ParseError::None;
+}
+
+// Copy a string into the memory of the value being parsed. Nothing frees it
+// but the reset of the record arena.
+static StringRef arenaString(std::string_view s)
+{
+	void *data = valueResource->allocate(s.size() ? s.size() : 1, 1);
+	memcpy(data, s.data(), s.size());
+	return {static_cast<const uint8_t *>(data), s.size(), StringRef::Latin1};
+}
+
+// the length of a string in characters, when it is ASCII
+static size_t asciiLength(const StringRef &s)
+{
+	return s.encoding == StringRef::Utf16 ? s.size / 2 : s.size;
+}
+
+// the character at `i`, or -1 when it isn't ASCII
+static int asciiAt(const StringRef &s, size_t i)
+{
+	if (s.encoding == StringRef::Utf16) {
+		return s.data[2 * i + 1] == 0 && s.data[2 * i] < 0x80 ?
+				s.data[2 * i] : -1;
+	}
+	return s.data[i] < 0x80 ? s.data[i] : -1;
+}
+
+// The property names a consumer looks for, known at compile time and found
+// with a perfect hash of their length and of three of their characters: a
+// name is compared with at most one of them.
+template <size_t N>
+class PerfectFieldSet
+{
+public:
+	static constexpr size_t tableSize = N <= 8 ? 16 : N <= 16 ? 32 : 64;
+	static_assert(N <= 32, "too many fields");
+
+	constexpr explicit PerfectFieldSet(const std::string_view (&names)[N]) :
+			names_(), slots_(), seed_(0)
+	{
+		for (size_t i = 0; i < N; ++i) {
+			names_[i] = names[i];
+		}
+		// the first seed for which no two names share a slot
+		for (uint32_t seed = 1; seed_ == 0; ++seed) {
+			if (seed == 100000) {
+				throw "no perfect hash of the field names";
+			}
+			for (size_t i = 0; i < tableSize; ++i) {
+				slots_[i] = -1;
+			}
+			bool collision = false;
+			for (size_t i = 0; i < N && !collision; ++i) {
+				const std::string_view n = names[i];
+				const size_t slot = hash(seed, n.size(), n[0],
+										 n[n.size() / 2], n.back());
+				collision = slots_[slot] >= 0;
+				slots_[slot] = (int8_t) i;
+			}
+			if (!collision) {
+				seed_ = seed;
+			}
+		}
+	}
+
+	// the index of the field called `name`, -1 for the other names
+	int find(const StringRef &name) const
+	{
+		const size_t length = asciiLength(name);
+		if (length == 0) {
+			return -1;
+		}
+		const int first = asciiAt(name, 0);
+		const int middle = asciiAt(name, length / 2);
+		const int last = asciiAt(name, length - 1);
+		if ((first | middle | last) < 0) {
+			return -1;
+		}
+		const int field = slots_[hash(seed_, length, first, middle, last)];
+		return field >= 0 && name.equals(names_[field]) ? field : -1;
+	}
+
+	constexpr const std::string_view &name(size_t field) const
+	{
+		return names_[field];
+	}
+
+private:
+	static constexpr size_t hash(uint32_t seed, size_t length, int first,
+								 int middle, int last)
+	{
+		uint32_t h = ((uint32_t) length ^ seed) * 0x9e3779b1u;
+		h = (h ^ (uint32_t) first) * 0x85ebca6bu;
+		h = (h ^ (uint32_t) middle) * 0xc2b2ae35u;
+		h = (h ^ (uint32_t) last) * 0x27d4eb2fu;
+		return (h >> 24) & (tableSize - 1);
+	}
+
+	std::string_view names_[N];
+	int8_t slots_[tableSize];
+	uint32_t seed_;
+};
+
+// The name of a property, which is a number for the integer indexed ones.
+// The names stay StringRefs into the record rather than interned symbols:
+// interning every key measured about 15% slower on contact databases, for
+// no memory saved, as the names cost no allocation.
+static bool propertyName(const V8Item &item, StringRef &name)
+{
+	char buffer[32];
+	switch (item.kind) {
+	case V8Item::String:
+		name = item.string;
+		return true;
+	case V8Item::Int:
+		snprintf(buffer, sizeof(buffer), "%" PRId32, item.int32);
+		break;
+	case V8Item::Uint:
+		snprintf(buffer, sizeof(buffer), "%" PRIu64, item.uint);
+		break;
+	case V8Item::Double:
+		snprintf(buffer, sizeof(buffer), "%.17g", item.number);
+		break;
+	default:
+		return false;
+	}
+	name = arenaString(buffer);
+	return true;
+}
+
+static std::string regExpString(const V8Item &item)
+{
+	// the flags in the order of RegExp.prototype.flags
+	static const struct
+	{
+		unsigned bit;
+		char flag;
+	} flags[] = {
+		{128, 'd'}, {1, 'g'}, {2, 'i'}, {64, 'l'}, {4, 'm'}, {32, 's'},
+		{16, 'u'}, {256, 'v'}, {8, 'y'}
+	};
+
+	std::string result = "/" + item.string.str() + "/";
+	for (const auto &f : flags) {
+		if (item.uint & f.bit) {
+			result += f.flag;
+		}
+	}
+	return result;
+}
+
+static std::string errorString(const V8Item &item)
+{
+	const char *name;
+	switch (item.errorTag) {
+	case 'E':
+		name = "EvalError";
+		break;
+	case 'R':
+		name = "RangeError";
+		break;
+	case 'F':
+		name = "ReferenceError";
+		break;
+	case 'S':
+		name = "SyntaxError";
+		break;
+	case 'T':
+		name = "TypeError";
+		break;
+	case 'U':
+		name = "URIError";
+		break;
+	default:
+		name = "Error";
+		break;
+	}
+	return std::string(name) + ": " + item.string.str();
+}
+
+// the Value of an item which isn't the beginning or the end of a container
+static Value itemValue(const V8Item &item)
+{
+	switch (item.kind) {
+	case V8Item::Bool:
+		return Value(item.uint != 0);
+	case V8Item::Int:
+		return Value((int) item.int32);
+	case V8Item::Uint:
+		return Value(item.uint);
+	case V8Item::Double:
+		return Value(item.number);
+	case V8Item::Date:
+		return Value(Date {item.number});
+	case V8Item::BigInt:
+		return Value(item.bigInt);
+	case V8Item::String:
+		return Value(item.string);
+	case V8Item::Reference:
+		return Value(ObjectRef {item.uint});
+	case V8Item::RegExp:
+		return Value(regExpString(item));
+	case V8Item::Binary:
+		return Value(item.binary);
+	case V8Item::Error:
+		return Value(errorString(item));
+	default:
+		return Value();
+	}
+}
+
+// nesting allowed by default, V8 itself fails deeper than this
+static const size_t defaultMaxDepth = 256;
+
+// An object, an array, a Map or a Set being filled by parseVal(), it is
+// already in place in its parent so nothing is moved when it is closed.
+struct ContainerFrame
+{
+	V8Item::Kind kind; // the begin kind
+	Value::KeyValuePairs *properties = nullptr; // objects
+	Value::Values *elements = nullptr;          // dense arrays and Sets
+	Value::ValuePairs *pairs = nullptr;         // sparse arrays and Maps
+	uint64_t remaining = 0;  // elements expected in a dense array
+	StringRef key;           // of the current property
+	bool hasPending = false; // a key, or the first value of a pair, was read
+};
+
+// Add a complete value, or a container about to be filled, to the innermost
+// container. The property names are handled by parseVal().
+static void addToContainer(ContainerFrame &frame, Value &&v)
+{
+	switch (frame.kind) {
+	case V8Item::BeginObject:
+		frame.properties->emplace_back(frame.key, std::move(v));
+		frame.hasPending = false;
+		break;
+	case V8Item::BeginDenseArray:
+		if (frame.remaining != 0) {
+			frame.remaining--;
+		}
+		frame.elements->emplace_back(std::move(v));
+		frame.hasPending = false;
+		break;
+	case V8Item::BeginSet:
+		frame.elements->emplace_back(std::move(v));
+		break;
+	default:
+		if (frame.hasPending) {
+			frame.pairs->back().second = std::move(v);
+			frame.hasPending = false;
+		} else {
+			frame.pairs->emplace_back(std::move(v), Value());
+			frame.hasPending = true;
+		}
+		break;
+	}
+}
+
+// Parse a value without recursion: the containers being filled are kept on
+// an explicit stack, so nesting only costs a frame in the arena and more
+// than `maxDepth` levels are rejected.
+static ParseResult<Value> parseVal(const uint8_t **p, const uint8_t *const pend,
+								   size_t maxDepth = defaultMaxDepth,
+								   uint32_t version = defaultV8Version)
+{
+	std::pmr::vector<ContainerFrame> stack(valueResource);
+	stack.reserve(8);
+	Value root;
+	V8Reader r {*p, pend, version};
+	V8Item item;
+
+	while (true) {
+		const ParseError error = readItem(r, item);
+		if (error != ParseError::None) {
+			return error;
+		}
+
+		if (!stack.empty() && !stack.back().hasPending && !item.isEnd() &&
+			(stack.back().kind == V8Item::BeginObject ||
+			 (stack.back().kind == V8Item::BeginDenseArray &&
+			  stack.back().remaining == 0))) {
+			// Property names are the most common values, keep them out of a
+			// Value. The properties of a dense array after its elements
+			// only have their values kept.
+			ContainerFrame &frame = stack.back();
+			if (!propertyName(item, frame.key)) {
+				return ParseError::BadStructure;
+			}
+			frame.hasPending = true;
+			continue;
+		}
+
+		if (item.isEnd()) {
+			// the end must match the innermost container
+			if (stack.empty()) {
+				return ParseError::BadStructure;
+			}
+			const ContainerFrame &frame = stack.back();
+			if (item.kind != frame.kind + 1 || frame.remaining != 0 ||
+				frame.hasPending) {
+				return ParseError::BadStructure;
+			}
+			stack.pop_back();
+			if (stack.empty()) {
+				*p = r.p;
+				return root;
+			}
+			continue;
+		}
+
+		if (!item.isBegin()) {
+			Value v = itemValue(item);
+			if (stack.empty()) {
+				*p = r.p;
+				return v;
+			}
+			addToContainer(stack.back(), std::move(v));
+			continue;
+		}
+
+		if (stack.size() == maxDepth) {
+			return ParseError::TooDeep;
+		}
+		ContainerFrame frame;
+		frame.kind = item.kind;
+		Value container;
+		switch (item.kind) {
+		case V8Item::BeginObject: {
+			auto properties = Value::makeContainer<Value::KeyValuePairs>();
+			frame.properties = properties.get();
+			container = Value(std::move(properties));
+			break;
+		}
+		case V8Item::BeginDenseArray:
+		case V8Item::BeginSet: {
+			auto elements = Value::makeContainer<Value::Values>();
+			frame.elements = elements.get();
+			frame.remaining = item.kind == V8Item::BeginDenseArray ?
+					item.uint : 0;
+			container = Value(std::move(elements));
+			break;
+		}
+		default: {
+			auto pairs = Value::makeContainer<Value::ValuePairs>();
+			frame.pairs = pairs.get();
+			container = Value(std::move(pairs));
+			break;
+		}
+		}
+
+		if (stack.empty()) {
+			root = std::move(container);
+		} else {
+			addToContainer(stack.back(), std::move(container));
+		}
+		stack.push_back(frame);
+	}
+}
+
+// Pull parser over the same V8 serialization tags as parseVal(), which
+// doesn't build a Value tree: it returns one token at a time, strings are
+// left in the input as a StringRef and the values a consumer doesn't want
+// are skipped as a whole.
+class PullParser
+{
+public:
+	enum Token {
+		BeginObject,
+		EndObject,
+		BeginArray, // dense and sparse arrays, Maps and Sets
+		EndArray,
+		String,
+		Int,
+		Number,
+		Bool,
+		Null,
+		Other, // Dates, BigInts, references, RegExps, ArrayBuffers, Errors
+		End,
+		Error
+	};
+
+	PullParser(const uint8_t *p, const uint8_t *pend,
+			   uint32_t version = defaultV8Version) :
+			reader_ {p, pend, version}
+	{
+	}
+
+	Token next();
+
+	// skip the value which starts with the token just returned by next(),
+	// for an object or an array this is up to its closing tag
+	bool skipValue(Token token);
+
+	// Advance to the next field of the current object whose name is one of
+	// `fields`, a PerfectFieldSet, and return its index, skipping the other
+	// fields and their values. The first token of the value is stored in
+	// `token`. Returns -1 at the end of the object, or on error.
+	template <class Fields>
+	int nextField(const Fields &fields, Token &token);
+
+	const StringRef &stringValue() const { return item_.string; }
+	int intValue() const { return item_.int32; }
+	double numberValue() const { return item_.number; }
+	bool boolValue() const { return item_.uint != 0; }
+	// the item just decoded, for the Other tokens
+	const V8Item &item() const { return item_; }
+
+	// why next() returned Error
+	ParseError error() const { return error_; }
+
+private:
+	Token fail(ParseError error)
+	{
+		error_ = error;
+		return Error;
+	}
+
+	V8Reader reader_;
+	size_t depth_ = 0;
+	ParseError error_ = ParseError::None;
+	V8Item item_;
+};
+
+PullParser::Token PullParser::next()
+{
+	do {
+		if (reader_.p >= reader_.pend) {
+			return depth_ == 0 ? End : fail(ParseError::Truncated);
+		}
+		const ParseError error = decodeItem(reader_, item_);
+		if (error != ParseError::None) {
+			return fail(error);
+		}
+	} while (item_.kind == V8Item::Padding);
+
+	switch (item_.kind) {
+	case V8Item::Null:
+		return Null;
+	case V8Item::Bool:
+		return Bool;
+	case V8Item::Int:
+		return Int;
+	case V8Item::Uint:
+		item_.int32 = (int32_t) item_.uint;
+		return Int;
+	case V8Item::Double:
+		return Number;
+	case V8Item::String:
+		return String;
+	case V8Item::BeginObject:
+		depth_++;
+		return BeginObject;
+	case V8Item::BeginDenseArray:
+	case V8Item::BeginSparseArray:
+	case V8Item::BeginMap:
+	case V8Item::BeginSet:
+		depth_++;
+		return BeginArray;
+	case V8Item::EndObject:
+	case V8Item::EndDenseArray:
+	case V8Item::EndSparseArray:
+	case V8Item::EndMap:
+	case V8Item::EndSet:
+		if (depth_ == 0) {
+			return fail(ParseError::BadStructure);
+		}
+		depth_--;
+		return item_.kind == V8Item::EndObject ? EndObject : EndArray;
+	default:
+		return Other;
+	}
+}
+
+bool PullParser::skipValue(Token token)
+{
+	if (token != BeginObject && token != BeginArray) {
+		return token != Error && token != End;
+	}
+
+	const size_t depth = depth_ - 1;
+	do {
+		token = next();
+		if (token == Error) {
+			return false;
+		}
+	} while (depth_ != depth);
+	return true;
+}
+
+template <class Fields>
+int PullParser::nextField(const Fields &fields, Token &token)
+{
+	while (true) {
+		// the key, or the end of the object
+		token = next();
+		// integer indexed properties are never one of the fields
+		const bool isName = token == String;
+		if (!isName && token != Int && token != Number) {
+			if (token != EndObject && token != Error) {
+				fail(ParseError::BadStructure);
+			}
+			return -1;
+		}
+		const StringRef key = item_.string;
+		token = next();
+		if (token == EndObject || token == EndArray || token == End) {
+			fail(ParseError::BadStructure);
+			return -1;
+		}
+		const int field = isName ? fields.find(key) : -1;
+		if (field >= 0) {
+			return field;
+		}
+		if (!skipValue(token)) {
+			return -1;
+		}
+	}
+}
+
+// The elements of the array, Map or Set which `parser` just began: the
+// values of a dense array then of the properties following them, the values
+// of a sparse array or of a Map without their keys, the values of a Set.
+class ArrayElements
+{
+public:
+	explicit ArrayElements(PullParser &parser) : parser_(parser)
+	{
+		const V8Item &item = parser.item();
+		remaining_ = item.kind == V8Item::BeginDenseArray ? item.uint : 0;
+		keyed_ = item.kind != V8Item::BeginSet;
+	}
+
+	// Store the first token of the next element in `token`, returns false
+	// at the end of the array or on error.
+	bool next(PullParser::Token &token)
+	{
+		token = parser_.next();
+		if (remaining_ != 0) {
+			remaining_--;
+		} else if (keyed_ && isValue(token) && parser_.skipValue(token)) {
+			// the key, any value in a Map
+			token = parser_.next();
+		}
+		return isValue(token);
+	}
+
+private:
+	static bool isValue(PullParser::Token token)
+	{
+		return token != PullParser::EndArray &&
+				token != PullParser::EndObject && token != PullParser::End &&
+				token != PullParser::Error;
+	}
+
+	PullParser &parser_;
+	uint64_t remaining_; // values of a dense array not read yet
+	bool keyed_;
+};
+
+} // namespace parsers
+
+// number of records skipped because of each ParseError, for all threads
+static std::atomic<uint64_t> skippedRecords[(size_t) parse_result::ParseError::Count];
+
+static void count_skipped_record(parse_result::ParseError error)
+{
+	skippedRecords[(size_t) error].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void print_skipped_records()
+{
+	using parse_result::ParseError;
+
+	uint64_t total = 0;
+	for (const auto &count : skippedRecords) {
+		total += count.load();
+	}
+	if (total == 0) {
+		return;
+	}
+	fprintf(stderr, "skipped %" PRIu64 " malformed records:\n", total);
+	for (size_t i = 1; i < (size_t) ParseError::Count; ++i) {
+		const uint64_t count = skippedRecords[i].load();
+		if (count != 0) {
+			fprintf(stderr, "  %s: %" PRIu64 "\n",
+					parse_result::parseErrorNames[i], count);
+		}
+	}
+}
+
+// the V8 serialized value inside the envelopes of an IndexedDB record
+struct IdbValue
+{
+	const uint8_t *data = nullptr; // past the V8 header
+	const uint8_t *end = nullptr;
+	uint64_t recordVersion = 0;
+	uint32_t blinkVersion = 0;
+	uint32_t v8Version = 0; // 0 when the record isn't a serialized value
+};
+
+// The versions of the Blink and of the V8 serialization formats understood.
+// Newer versions are read as the newest known one, which they extend.
+static const uint32_t minBlinkVersion = 13;
+static const uint32_t blinkTrailerVersion = 21;
+static const uint32_t minV8Version = 13;
+
+// Blink marks the values it wrapped with this pseudo version followed by
+// the kind of wrapping
+static const uint8_t blinkWrappedValueVersion = 0x11;
+static const uint8_t blinkReplacedWithBlob = 1;
+static const uint8_t blinkCompressedWithSnappy = 2;
+
+// Decode the envelopes around the V8 serialized value of a record:
+// - the varint version of the IndexedDB record
+// - the Blink wrapping of large values, which are either moved to a blob
+//   file or compressed with Snappy; the latter are decompressed into a
+//   buffer of the calling thread, valid until its next call
+// - the Blink header, 0xff and the Blink version, then from version 21 the
+//   offset of a trailer, 0xfe followed by 12 bytes
+// - the V8 header, 0xff and the V8 version
+static parsers::ParseResult<IdbValue> decode_idb_value(const uint8_t *data,
+													   size_t size)
+{
+	using parsers::ParseError;
+
+	static thread_local std::string uncompressed;
+
+	const uint8_t *p = data;
+	const uint8_t *pend = data + size;
+	IdbValue value;
+	if (!varint::decode(&p, pend, &value.recordVersion)) {
+		return ParseError::BadVarInt;
+	}
+
+	if (p == pend || *p != 0xff) {
+		// not a serialized value, the data is left to the caller
+		value.data = p;
+		value.end = pend;
+		return value;
+	}
+
+	uint64_t version;
+	while (true) {
+		if (p == pend || *p++ != 0xff) {
+			return ParseError::BadHeader;
+		}
+		if (!varint::decode(&p, pend, &version)) {
+			return ParseError::BadVarInt;
+		}
+		if (version != blinkWrappedValueVersion || p == pend ||
+			(*p != blinkReplacedWithBlob && *p != blinkCompressedWithSnappy)) {
+			break;
+		}
+		if (*p++ == blinkReplacedWithBlob) {
+			return ParseError::ExternalValue;
+		}
+		if (data == reinterpret_cast<const uint8_t *>(uncompressed.data())) {
+			// compressed twice
+			return ParseError::BadCompression;
+		}
+		// the compressed value has its own Blink header
+		if (!compression::snappy_uncompress(p, pend - p, uncompressed)) {
+			return ParseError::BadCompression;
+		}
+		p = reinterpret_cast<const uint8_t *>(uncompressed.data());
+		pend = p + uncompressed.size();
+		data = p;
+	}
+
+	if (version < minBlinkVersion) {
+		return ParseError::UnsupportedVersion;
+	}
+	value.blinkVersion = (uint32_t) version;
+	if (version >= blinkTrailerVersion && p != pend && *p == 0xfe) {
+		if (pend - p < 13) {
+			return ParseError::Truncated;
+		}
+		p += 13;
+	}
+
+	if (p == pend || *p++ != 0xff) {
+		return ParseError::BadHeader;
+	}
+	if (!varint::decode(&p, pend, &version)) {
+		return ParseError::BadVarInt;
+	}
+	if (version < minV8Version) {
+		return ParseError::UnsupportedVersion;
+	}
+	value.v8Version = (uint32_t) version;
+	value.data = p;
+	value.end = pend;
+	return value;
+}
+
+static parsers::ParseResult<parsers::Value> parse_skype_contact_blob(
+		const uint8_t *data, size_t size, size_t maxDepth)
+{
+	using namespace parsers;
+
+	const auto value = decode_idb_value(data, size);
+	if (!value) {
+		return value.error;
+	}
+	if (value.value.v8Version == 0) {
+		return ParseError::BadHeader;
+	}
+
+	// expect object 'o'
+	const uint8_t *p = value.value.data;
+	return parseVal(&p, value.value.end, maxDepth, value.value.v8Version);
+}
+
+// the range of the JavaScript Dates, in milliseconds around the epoch
+static const double maxTimestamp = 8.64e15;
+
+// the zone of the message times, set by the -tz option, UTC when null
+static const civil::TimeZone *timeZone = nullptr;
+
+// Write a time in milliseconds since the epoch, nothing when it isn't a
+// valid JavaScript time. The messages come grouped by conversation and
+// mostly in order, so the formatter's per-day cache nearly always hits.
+static void writeSkypeTimestamp(output::OutputBuffer &out, double ms)
+{
+	if (!(std::fabs(ms) <= maxTimestamp)) {
+		return;
+	}
+	static thread_local civil::TimestampFormatter formatter(timeZone);
+	char *p = out.reserve(civil::TimestampFormatter::maxLength);
+	out.advance(formatter.format((int64_t) std::floor(ms), p));
+}
+
+// the whole milliseconds since the epoch of a time, for the -epoch-ms option
+static void writeSkypeTimestampEpochMs(output::OutputBuffer &out, double ms)
+{
+	if (!(std::fabs(ms) <= maxTimestamp)) {
+		return;
+	}
+	out.appendInteger((int64_t) std::floor(ms));
 }
 
-} // namespace parsers
+// the formats of the records displayed
+enum class OutputFormat {
+	Text,
+	Csv,
+	Json, // one object per line, JSON Lines
+	Arrow, // an Arrow IPC stream, for the messages only
+	Sqlite, // the rows loaded into the -sqlite database
+	Archive // the rows of the messages written to the -archive file
+};
 
-static parsers::Value parse_skype_contact_blob(const uint8_t *data, size_t size)
+// write a text field of a record as a CSV field
+static void writeCsvField(output::OutputBuffer &out,
+						  const parsers::StringRef &s)
 {
-	using namespace parsers;
+	if (s.encoding == parsers::StringRef::Utf8 || s.isAscii()) {
+		escape::append_csv_field(out, std::string_view(
+				reinterpret_cast<const char *>(s.data), s.size));
+		return;
+	}
+	static thread_local std::string converted;
+	converted.clear();
+	s.appendTo(converted);
+	escape::append_csv_field(out, converted);
+}
 
-	const uint8_t *p = data;
-	const uint8_t * const pend = data + size;
+// write a text field of a record as a JSON string
+static void writeJsonString(output::OutputBuffer &out,
+							const parsers::StringRef &s)
+{
+	if (s.encoding == parsers::StringRef::Utf8 || s.isAscii()) {
+		escape::append_json_string(out, std::string_view(
+				reinterpret_cast<const char *>(s.data), s.size));
+		return;
+	}
+	static thread_local std::string converted;
+	converted.clear();
+	s.appendTo(converted);
+	escape::append_json_string(out, converted);
+}
+
+// A message record with only the fields which are displayed, decoded
+// without building a Value tree. The strings point into the record.
+struct SkypeMessage
+{
+	// the fields, the displayed ones in the order of the CSV columns
+	enum Field {
+		MessageType,
+		Cuid,
+		ConversationId,
+		Creator,
+		CreatedTime,
+		ComposeTime,
+		Content,
+		FieldCount
+	};
+
+	static constexpr std::string_view fieldNames[FieldCount] = {
+		"messagetype",
+		"cuid",
+		"conversationId",
+		"creator",
+		"createdTime",
+		"composeTime",
+		"content"
+	};
+
+	static bool isTime(int field)
+	{
+		return field == CreatedTime || field == ComposeTime;
+	}
+
+	bool has(int field) const { return (present >> field & 1) != 0; }
+
+	// only the text messages are displayed
+	bool isText() const
+	{
+		return has(MessageType) && (text[MessageType].equals("RichText") ||
+				text[MessageType].equals("Text"));
+	}
+
+	parsers::StringRef text[FieldCount]; // the string fields
+	double time[FieldCount] = {};        // the time fields, epoch ms
+	uint32_t present = 0;                // bit n is set for field n
+};
+
+static constexpr parsers::PerfectFieldSet messageFieldSet(
+		SkypeMessage::fieldNames);
+
+// Fill `message` with the fields of the object read by `parser`. Fields of
+// an unexpected type are left out, like the missing ones.
+static parsers::ParseError decode_skype_message(parsers::PullParser &parser,
+												SkypeMessage &message)
+{
+	using parsers::PullParser;
+
+	const PullParser::Token first = parser.next();
+	if (first != PullParser::BeginObject) {
+		return first == PullParser::Error ? parser.error() :
+				parsers::ParseError::BadStructure;
+	}
+
+	PullParser::Token token;
+	for (int field; (field = parser.nextField(messageFieldSet, token)) >= 0;) {
+		const bool isTime = SkypeMessage::isTime(field);
+		if (token != (isTime ? PullParser::Number : PullParser::String)) {
+			parser.skipValue(token);
+			continue;
+		}
+		if (isTime) {
+			message.time[field] = parser.numberValue();
+		} else {
+			message.text[field] = parser.stringValue();
+		}
+		message.present |= 1u << field;
+	}
+	return parser.error();
+}
 
-	// first field is a Varint, maybe the record ID
-	parseVarInt(&p, pend);
-	// expect 0xff
-	assert(*p == 0xff);
-	p++;
-	parseVarInt(&p, pend);
-	// expect 0xff
-	assert(*p == 0xff);
-	p++;
+// Write the displayed fields of a message, always in the same order. A
+// missing field is an empty CSV column, in text and JSON it is left out.
+// The times are written in ISO 8601, or as numbers of milliseconds when
+// `epochMs` is set.
+static void format_skype_message(output::OutputBuffer &out,
+								 const SkypeMessage &message,
+								 OutputFormat format, const bool epochMs)
+{
+	const auto writeTime = epochMs ? writeSkypeTimestampEpochMs :
+			writeSkypeTimestamp;
+	char separator = '{';
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		const bool isTime = SkypeMessage::isTime(field);
+		const bool has = message.has(field);
+		if (format == OutputFormat::Text) {
+			if (!has) {
+				continue;
+			}
+			if (field == SkypeMessage::Content) {
+				out << '\n' << message.text[field] << '\n';
+				continue;
+			}
+			out << SkypeMessage::fieldNames[field] << '=';
+			if (isTime) {
+				writeTime(out, message.time[field]);
+			} else {
+				out << message.text[field];
+			}
+			out << '\n';
+		} else if (format == OutputFormat::Csv) {
+			// the times never need quoting
+			if (has && isTime) {
+				writeTime(out, message.time[field]);
+			} else if (has) {
+				writeCsvField(out, message.text[field]);
+			}
+			if (field != SkypeMessage::Content) {
+				out << ',';
+			}
+		} else {
+			if (!has) {
+				continue;
+			}
+			out << separator << '"' << SkypeMessage::fieldNames[field] << "\":";
+			separator = ',';
+			if (!isTime) {
+				writeJsonString(out, message.text[field]);
+			} else if (!(std::fabs(message.time[field]) <= maxTimestamp)) {
+				out << "null";
+			} else if (epochMs) {
+				writeTime(out, message.time[field]);
+			} else {
+				out << '"';
+				writeTime(out, message.time[field]);
+				out << '"';
+			}
+		}
+	}
+	if (format == OutputFormat::Json) {
+		out << (separator == '{' ? "{}" : "}");
+	}
+}
 
-	// expect 0x0d
-	assert(*p == 0x0d);
-	p++;
+// Decode a message record, false when it isn't a text message or when it
+// can't be decoded.
+static bool decode_skype_message_blob(const uint8_t *data, const size_t size,
+									  SkypeMessage &message)
+{
+	const auto value = decode_idb_value(data, size);
+	if (!value) {
+		count_skipped_record(value.error);
+		return false;
+	}
+	if (value.value.v8Version == 0) {
+		count_skipped_record(parsers::ParseError::BadHeader);
+		return false;
+	}
 
-	// 2. expect object 'o'
-	return parseVal(&p, pend);
+	// expect object 'o', only the displayed fields are decoded
+	parsers::PullParser parser(value.value.data, value.value.end,
+							   value.value.v8Version);
+	const parsers::ParseError error = decode_skype_message(parser, message);
+	if (error != parsers::ParseError::None) {
+		count_skipped_record(error);
+		return false;
+	}
+	return message.isText();
 }
 
-static std::string skypeTimestampToString(uint64_t ts)
+// write a message followed by an empty line, or by a line break in CSV and
+// JSON
+static void write_skype_message(output::OutputBuffer &out,
+								const SkypeMessage &message,
+								OutputFormat format, bool epochMs)
 {
-	time_t t = (ts - 4782822804267467000) / 4096000;
-	struct tm parts = {};
-	gmtime_r(&t, &parts);
-	char buffer[80];
-	snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d-%02d-%02dZ",
-			 parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
-			 parts.tm_hour, parts.tm_min, parts.tm_sec);
-	return buffer;
+	const size_t start = out.size();
+	format_skype_message(out, message, format, epochMs);
+	if (out.size() != start) {
+		out << (format == OutputFormat::Text ? "\n\n" : "\n");
+	}
 }
 
-static std::string &toCsvFieldValue(std::string &val)
+// Write a message record, nothing is written for the records which aren't
+// text messages.
+static void show_skype_message_blob(output::OutputBuffer &out,
+									const uint8_t *data, const size_t size,
+									OutputFormat format, bool epochMs)
 {
-	auto pos = val.find_first_of(",\"\n\r");
-	if (pos == std::string::npos) {
-		return val;
+	SkypeMessage message;
+	if (decode_skype_message_blob(data, size, message)) {
+		write_skype_message(out, message, format, epochMs);
 	}
+}
 
-	val.insert(0, 1, '"');
-	pos++;
-	if (val[pos] == '"') {
-		val.insert(pos, 1, '"');
-		pos += 2;
+// the columns of the -arrow output, the displayed fields of the messages
+static std::vector<arrow_ipc::Column> message_arrow_columns()
+{
+	std::vector<arrow_ipc::Column> columns;
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		columns.push_back({SkypeMessage::fieldNames[field],
+						   SkypeMessage::isTime(field) ?
+								   arrow_ipc::ColumnType::TimestampMs :
+								   arrow_ipc::ColumnType::Utf8});
 	}
-	while (true) {
-		pos = val.find('"', pos);
-		if (pos != std::string::npos) {
-			val.insert(pos, 1, '"');
-			pos += 2;
+	return columns;
+}
+
+// Add a message to a record batch of the message_arrow_columns(). The
+// missing fields and the times which aren't valid are nulls.
+static void append_skype_message_row(arrow_ipc::RecordBatchBuilder &batch,
+									 const SkypeMessage &message)
+{
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		const size_t column = field - SkypeMessage::Cuid;
+		const parsers::StringRef &s = message.text[field];
+		const double ms = message.time[field];
+		if (!message.has(field)) {
+			batch.appendNull(column);
+		} else if (SkypeMessage::isTime(field)) {
+			if (std::fabs(ms) <= maxTimestamp) {
+				batch.appendTimestamp(column, (int64_t) std::floor(ms));
+			} else {
+				batch.appendNull(column);
+			}
+		} else if (s.encoding == parsers::StringRef::Utf8 || s.isAscii()) {
+			batch.appendString(column, std::string_view(
+					reinterpret_cast<const char *>(s.data), s.size));
 		} else {
-			break;
+			static thread_local std::string converted;
+			converted.clear();
+			s.appendTo(converted);
+			batch.appendString(column, converted);
 		}
 	}
-	val += '"';
-	return val;
 }
 
-static std::string show_skype_message(const parsers::Value &v,
-									  const bool useCsvFormat)
+// a phone number of a contact, the type is "mobile", "home"...
+struct SkypePhone
 {
-	using namespace parsers;
+	parsers::StringRef type;
+	parsers::StringRef number;
+};
 
-	if (!std::holds_alternative<Value::KeyValuePairsPtr>(v.vt_)) {
-		return std::string();
-	}
+// A contact record with only the fields which are displayed, decoded
+// without building a Value tree. The strings point into the record, the
+// lists are allocated from the record arena.
+struct SkypeContact
+{
+	// the fields, in the order they are displayed
+	enum Field {
+		Mri,
+		DisplayName,
+		FirstName,
+		LastName,
+		Birthday,
+		City,
+		Country,
+		Mood,
+		AvatarUrl,
+		Phones,
+		Emails,
+		IsBlocked,
+		FieldCount
+	};
 
-	auto pairs = std::get<Value::KeyValuePairsPtr>(v.vt_).get();
-	std::ostringstream os;
+	static constexpr std::string_view fieldNames[FieldCount] = {
+		"mri",
+		"displayName",
+		"firstName",
+		"lastName",
+		"birthday",
+		"city",
+		"country",
+		"mood",
+		"avatarUrl",
+		"phones",
+		"emails",
+		"isBlocked"
+	};
 
-	bool messageOk = false;
-	std::string currentValue;
-	for (auto const &[k, val] : *pairs) {
-		if (k == "messagetype") {
-			auto const &mtype = std::get<std::string>(val.vt_);
-			messageOk = (mtype == "RichText" || mtype == "Text");
-			continue;
-		} else if (k == "cuid" || k == "conversationId" || k == "creator") {
-			currentValue = std::get<std::string>(val.vt_);
-		} else if (k == "createdTime" || k == "composeTime") {
-			currentValue = skypeTimestampToString(std::get<uint64_t>(val.vt_));
-		} else if (k == "content") {
-			currentValue = std::get<std::string>(val.vt_);
+	static bool isText(int field) { return field < Phones; }
+
+	bool has(int field) const { return (present >> field & 1) != 0; }
+
+	parsers::StringRef text[FieldCount]; // the string fields
+	std::pmr::vector<SkypePhone> phones {parse_result::valueResource};
+	std::pmr::vector<parsers::StringRef> emails {parse_result::valueResource};
+	bool isBlocked = false;
+	uint32_t present = 0; // bit n is set for field n
+};
+
+enum PhoneField {
+	PhoneType,
+	PhoneNumber
+};
+
+static constexpr std::string_view phoneFieldNames[] = {
+	"type",
+	"number"
+};
+
+static constexpr parsers::PerfectFieldSet contactFieldSet(
+		SkypeContact::fieldNames);
+static constexpr parsers::PerfectFieldSet phoneFieldSet(phoneFieldNames);
+
+// the phones are objects with a type and a number, or only numbers
+static void decode_skype_phones(parsers::PullParser &parser,
+								std::pmr::vector<SkypePhone> &phones)
+{
+	using parsers::PullParser;
+
+	parsers::ArrayElements elements(parser);
+	PullParser::Token token;
+	while (elements.next(token)) {
+		SkypePhone phone;
+		if (token == PullParser::String) {
+			phone.number = parser.stringValue();
+		} else if (token == PullParser::BeginObject) {
+			PullParser::Token value;
+			for (int field; (field = parser.nextField(phoneFieldSet,
+					value)) >= 0;) {
+				if (value != PullParser::String) {
+					parser.skipValue(value);
+				} else if (field == PhoneType) {
+					phone.type = parser.stringValue();
+				} else {
+					phone.number = parser.stringValue();
+				}
+			}
 		} else {
+			parser.skipValue(token);
 			continue;
 		}
+		if (phone.number.size != 0) {
+			phones.push_back(phone);
+		}
+	}
+}
 
-		if (!useCsvFormat) {
-			if (k != "content") {
-				os << k << '=' << currentValue << '\n';
-			} else {
-				os << '\n' << std::get<std::string>(val.vt_) << '\n';
+// Fill `contact` with the fields of the object read by `parser`. Fields of
+// an unexpected type are left out, like the missing ones.
+static parsers::ParseError decode_skype_contact(parsers::PullParser &parser,
+												SkypeContact &contact)
+{
+	using parsers::PullParser;
+
+	const PullParser::Token first = parser.next();
+	if (first != PullParser::BeginObject) {
+		return first == PullParser::Error ? parser.error() :
+				parsers::ParseError::BadStructure;
+	}
+
+	PullParser::Token token;
+	for (int field; (field = parser.nextField(contactFieldSet, token)) >= 0;) {
+		if (SkypeContact::isText(field) && token == PullParser::String) {
+			contact.text[field] = parser.stringValue();
+		} else if (field == SkypeContact::Phones &&
+				   token == PullParser::BeginArray) {
+			decode_skype_phones(parser, contact.phones);
+		} else if (field == SkypeContact::Emails &&
+				   token == PullParser::BeginArray) {
+			parsers::ArrayElements elements(parser);
+			PullParser::Token email;
+			while (elements.next(email)) {
+				if (email == PullParser::String) {
+					contact.emails.push_back(parser.stringValue());
+				} else {
+					parser.skipValue(email);
+				}
 			}
+		} else if (field == SkypeContact::IsBlocked &&
+				   token == PullParser::Bool) {
+			contact.isBlocked = parser.boolValue();
 		} else {
-			os << toCsvFieldValue(currentValue);
-			if (k != "content") {
-				os << ',';
+			parser.skipValue(token);
+			continue;
+		}
+		contact.present |= 1u << field;
+	}
+	return parser.error();
+}
+
+// the value of a CSV column, the lists are joined with ';' and a phone is
+// "type:number"
+static void contact_csv_value(const SkypeContact &contact, int field,
+							  std::string &value)
+{
+	if (SkypeContact::isText(field)) {
+		contact.text[field].appendTo(value);
+	} else if (field == SkypeContact::Phones) {
+		for (const SkypePhone &phone : contact.phones) {
+			if (!value.empty()) {
+				value += ';';
+			}
+			if (phone.type.size != 0) {
+				phone.type.appendTo(value);
+				value += ':';
 			}
+			phone.number.appendTo(value);
 		}
+	} else if (field == SkypeContact::Emails) {
+		for (const parsers::StringRef &email : contact.emails) {
+			if (!value.empty()) {
+				value += ';';
+			}
+			email.appendTo(value);
+		}
+	} else {
+		value = contact.isBlocked ? "true" : "false";
 	}
+}
 
-	if (messageOk) {
-		return os.str();
+// Write the displayed fields of a contact, always in the same order. In
+// text and JSON the missing fields are left out, in CSV they are empty
+// columns.
+static void format_skype_contact(output::OutputBuffer &ostr,
+								 const SkypeContact &contact,
+								 OutputFormat format)
+{
+	std::string value;
+	if (format == OutputFormat::Text) {
+		ostr << "BEGIN Contact -----\n";
+		for (int field = 0; field < SkypeContact::FieldCount; ++field) {
+			if (!contact.has(field)) {
+				continue;
+			}
+			const std::string_view name = SkypeContact::fieldNames[field];
+			if (SkypeContact::isText(field)) {
+				ostr << name << '=' << contact.text[field] << '\n';
+			} else if (field == SkypeContact::Phones) {
+				for (const SkypePhone &phone : contact.phones) {
+					ostr << "phone=" << phone.number;
+					if (phone.type.size != 0) {
+						ostr << " (" << phone.type << ')';
+					}
+					ostr << '\n';
+				}
+			} else if (field == SkypeContact::Emails) {
+				for (const parsers::StringRef &email : contact.emails) {
+					ostr << "email=" << email << '\n';
+				}
+			} else {
+				ostr << name << '=' << (contact.isBlocked ? "true" : "false")
+						<< '\n';
+			}
+		}
+		ostr << "END Contact -----\n";
+	} else if (format == OutputFormat::Csv) {
+		for (int field = 0; field < SkypeContact::FieldCount; ++field) {
+			value.clear();
+			if (contact.has(field)) {
+				contact_csv_value(contact, field, value);
+			}
+			escape::append_csv_field(ostr, value);
+			ostr << (field + 1 < SkypeContact::FieldCount ? ',' : '\n');
+		}
 	} else {
-		return std::string();
+		char separator = '{';
+		for (int field = 0; field < SkypeContact::FieldCount; ++field) {
+			if (!contact.has(field)) {
+				continue;
+			}
+			ostr << separator;
+			separator = ',';
+			escape::append_json_string(ostr, SkypeContact::fieldNames[field]);
+			ostr << ':';
+			if (SkypeContact::isText(field)) {
+				writeJsonString(ostr, contact.text[field]);
+			} else if (field == SkypeContact::Phones) {
+				char listSeparator = '[';
+				for (const SkypePhone &phone : contact.phones) {
+					ostr << listSeparator << '{';
+					listSeparator = ',';
+					if (phone.type.size != 0) {
+						ostr << "\"type\":";
+						writeJsonString(ostr, phone.type);
+						ostr << ',';
+					}
+					ostr << "\"number\":";
+					writeJsonString(ostr, phone.number);
+					ostr << '}';
+				}
+				ostr << (listSeparator == '[' ? "[]" : "]");
+			} else if (field == SkypeContact::Emails) {
+				char listSeparator = '[';
+				for (const parsers::StringRef &email : contact.emails) {
+					ostr << listSeparator;
+					listSeparator = ',';
+					writeJsonString(ostr, email);
+				}
+				ostr << (listSeparator == '[' ? "[]" : "]");
+			} else {
+				ostr << (contact.isBlocked ? "true" : "false");
+			}
+		}
+		ostr << (separator == '{' ? "{}\n" : "}\n");
 	}
 }
 
-static parsers::Value parse_skype_message_blob(const uint8_t *data,
-											   const size_t size)
+// decode a contact record, false when it can't be decoded
+static bool decode_skype_contact_blob(const uint8_t *data, const size_t size,
+									  SkypeContact &contact)
 {
-	using namespace parsers;
+	const auto value = decode_idb_value(data, size);
+	if (!value) {
+		count_skipped_record(value.error);
+		return false;
+	}
+	if (value.value.v8Version == 0) {
+		count_skipped_record(parsers::ParseError::BadHeader);
+		return false;
+	}
 
-	const uint8_t *p = data;
-	const uint8_t * const pend = data + size;
+	parsers::PullParser parser(value.value.data, value.value.end,
+							   value.value.v8Version);
+	const parsers::ParseError error = decode_skype_contact(parser, contact);
+	if (error != parsers::ParseError::None) {
+		count_skipped_record(error);
+		return false;
+	}
+	return true;
+}
+
+static void show_skype_contact_blob(output::OutputBuffer &ostr,
+									const uint8_t *data, const size_t size,
+									OutputFormat format)
+{
+	SkypeContact contact;
+	if (decode_skype_contact_blob(data, size, contact)) {
+		format_skype_contact(ostr, contact, format);
+	}
+}
+
+// the tables of the -sqlite database, in the order of sql_tables()
+enum SqlTable {
+	MessagesTable,
+	ContactsTable,
+	ConversationsTable
+};
+
+// The messages and the contacts have a column per displayed field, named
+// like in JSON, the times are milliseconds since the epoch. The
+// conversations are filled from the messages by sql_finish_statements().
+static std::vector<sqlite_export::Table> sql_tables()
+{
+	using sqlite_export::ColumnType;
+
+	std::vector<sqlite_export::Table> tables(3);
+	tables[MessagesTable].name = "messages";
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		tables[MessagesTable].columns.push_back({SkypeMessage::fieldNames[field],
+				SkypeMessage::isTime(field) ? ColumnType::Integer :
+						ColumnType::Text});
+	}
+	tables[ContactsTable].name = "contacts";
+	for (int field = 0; field < SkypeContact::FieldCount; ++field) {
+		tables[ContactsTable].columns.push_back({SkypeContact::fieldNames[field],
+				field == SkypeContact::IsBlocked ? ColumnType::Integer :
+						ColumnType::Text});
+	}
+	tables[ConversationsTable] = {"conversations", {
+		{"conversationId", ColumnType::Text},
+		{"messageCount", ColumnType::Integer},
+		{"firstCreatedTime", ColumnType::Integer},
+		{"lastCreatedTime", ColumnType::Integer}
+	}};
+	return tables;
+}
+
+// the indexes, created once the rows are loaded, then the conversations
+static std::vector<std::string> sql_finish_statements()
+{
+	return {
+		"CREATE INDEX messages_conversation ON messages "
+				"(conversationId, createdTime)",
+		"CREATE INDEX contacts_mri ON contacts (mri)",
+		"INSERT INTO conversations SELECT conversationId, count(*), "
+				"min(createdTime), max(createdTime) FROM messages "
+				"WHERE conversationId IS NOT NULL GROUP BY conversationId",
+		"CREATE UNIQUE INDEX conversations_id ON conversations "
+				"(conversationId)"
+	};
+}
+
+// write a text field of a record as a value of a row_stream row
+static void appendRowText(output::OutputBuffer &out,
+						  const parsers::StringRef &s)
+{
+	if (s.encoding == parsers::StringRef::Utf8 || s.isAscii()) {
+		row_stream::append_text(out, std::string_view(
+				reinterpret_cast<const char *>(s.data), s.size));
+		return;
+	}
+	static thread_local std::string converted;
+	converted.clear();
+	s.appendTo(converted);
+	row_stream::append_text(out, converted);
+}
+
+// the row of a message, a value per displayed field like in the messages
+// table, the missing fields and the times which aren't valid are nulls
+static void write_skype_message_row(output::OutputBuffer &out, size_t table,
+									const SkypeMessage &message)
+{
+	row_stream::begin_row(out, table);
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		const double ms = message.time[field];
+		if (!message.has(field)) {
+			row_stream::append_null(out);
+		} else if (!SkypeMessage::isTime(field)) {
+			appendRowText(out, message.text[field]);
+		} else if (std::fabs(ms) <= maxTimestamp) {
+			row_stream::append_integer(out, (int64_t) std::floor(ms));
+		} else {
+			row_stream::append_null(out);
+		}
+	}
+}
 
-	// first field is a Varint, maybe the record ID
-	parseVarInt(&p, pend);
-	if (*p != 0xff) {
-		// unexpected record type
-		return parsers::Value();
+// the row of a contact in the contacts table, the lists are joined like in
+// CSV
+static void write_skype_contact_row(output::OutputBuffer &out, size_t table,
+									const SkypeContact &contact)
+{
+	static thread_local std::string value;
+	row_stream::begin_row(out, table);
+	for (int field = 0; field < SkypeContact::FieldCount; ++field) {
+		if (!contact.has(field)) {
+			row_stream::append_null(out);
+		} else if (SkypeContact::isText(field)) {
+			appendRowText(out, contact.text[field]);
+		} else if (field == SkypeContact::IsBlocked) {
+			row_stream::append_integer(out, contact.isBlocked);
+		} else {
+			value.clear();
+			contact_csv_value(contact, field, value);
+			row_stream::append_text(out, value);
+		}
 	}
+}
 
-	// expect 0xff
-	assert(*p == 0xff);
-	p++;
+// The columns of the -archive file, the displayed fields of the messages,
+// the key of the archive is the conversation and its time the creation.
+static std::vector<archive::Column> message_archive_columns()
+{
+	std::vector<archive::Column> columns;
+	for (int field = SkypeMessage::Cuid; field < SkypeMessage::FieldCount;
+		 ++field) {
+		columns.push_back({SkypeMessage::fieldNames[field],
+						   SkypeMessage::isTime(field) ?
+								   archive::ColumnType::Time :
+								   archive::ColumnType::Text});
+	}
+	return columns;
+}
 
-	// expect 0x12
-	assert(*p == 0x12 || *p == 0x13 || *p == 0x14);
-	p++;
+static const size_t archiveKeyColumn =
+		SkypeMessage::ConversationId - SkypeMessage::Cuid;
+static const size_t archiveTimeColumn =
+		SkypeMessage::CreatedTime - SkypeMessage::Cuid;
+static const size_t archiveContentColumn =
+		SkypeMessage::Content - SkypeMessage::Cuid;
+
+// Write the messages of an archive which are in a conversation and created
+// in [from, to), each when given, in the order of their creation times.
+// The archive is found by binary search in its indexes, without reading
+// the rest of the file.
+static bool query_message_archive(output::OutputBuffer &out, const char *path,
+		const std::optional<std::string_view> &conversation,
+		const std::optional<int64_t> &from, const std::optional<int64_t> &to,
+		OutputFormat format, bool epochMs)
+{
+	archive::Archive messages;
+	std::string error;
+	if (!messages.open(path, error)) {
+		fprintf(stderr, "Archive error: %s\n", error.c_str());
+		return false;
+	}
 
-	// expect 0xff
-	assert(*p == 0xff);
-	p++;
+	// the columns are found by name, the missing ones are left out
+	int columns[SkypeMessage::FieldCount];
+	for (int field = 0; field < SkypeMessage::FieldCount; ++field) {
+		columns[field] = messages.column(SkypeMessage::fieldNames[field]);
+		const archive::ColumnType type = SkypeMessage::isTime(field) ?
+				archive::ColumnType::Time : archive::ColumnType::Text;
+		if (columns[field] >= 0 && messages.columnType(columns[field]) != type) {
+			columns[field] = -1;
+		}
+	}
 
-	// expect 0x0d
-	assert(*p == 0x0d);
-	p++;
+	arrow_ipc::RecordBatchBuilder batch(message_arrow_columns());
+	if (format == OutputFormat::Arrow) {
+		arrow_ipc::write_schema(out, message_arrow_columns());
+	}
+	// the decompressed values, until the message is written
+	std::string buffers[SkypeMessage::FieldCount];
+	for (uint32_t record : messages.query(conversation, from, to)) {
+		SkypeMessage message;
+		for (int field = 0; field < SkypeMessage::FieldCount; ++field) {
+			if (columns[field] < 0) {
+				continue;
+			}
+			if (SkypeMessage::isTime(field)) {
+				const auto ms = messages.time(record, columns[field]);
+				if (!ms) {
+					continue;
+				}
+				message.time[field] = (double) *ms;
+			} else {
+				const auto text = messages.text(record, columns[field],
+												buffers[field]);
+				if (!text) {
+					continue;
+				}
+				parsers::StringRef &s = message.text[field];
+				s.data = reinterpret_cast<const uint8_t *>(text->data());
+				s.size = text->size();
+				s.encoding = parsers::StringRef::Utf8;
+			}
+			message.present |= 1u << field;
+		}
 
-	// 2. expect object 'o'
-	return parseVal(&p, pend);
+		if (format != OutputFormat::Arrow) {
+			write_skype_message(out, message, format, epochMs);
+			continue;
+		}
+		append_skype_message_row(batch, message);
+		if (batch.endRow()) {
+			batch.write(out);
+		}
+	}
+	if (format == OutputFormat::Arrow) {
+		batch.write(out);
+		arrow_ipc::write_end_of_stream(out);
+	}
+	return true;
 }
 
-static std::string show_skype_message_blob(const uint8_t *data,
-										   const size_t size, bool useCsvFormat)
+// Parse a -from or -to time: milliseconds since the epoch, or a UTC date
+// and time written YYYY-MM-DD[THH:MM[:SS]][Z].
+static bool parse_time_argument(const char *text, int64_t &ms)
 {
-	return show_skype_message(parse_skype_message_blob(data, size),
-							  useCsvFormat);
+	char *end;
+	errno = 0;
+	const long long number = strtoll(text, &end, 10);
+	if (*end == '\0' && end != text && errno == 0) {
+		ms = number;
+		return true;
+	}
+
+	int year, month, day, hour = 0, minute = 0, second = 0, length = 0;
+	if (sscanf(text, "%4d-%2d-%2d%n", &year, &month, &day, &length) != 3 ||
+		length != 10) {
+		return false;
+	}
+	text += length;
+	if (*text == 'T' || *text == ' ') {
+		if (sscanf(text + 1, "%2d:%2d%n", &hour, &minute, &length) != 2 ||
+			length != 5) {
+			return false;
+		}
+		text += 1 + length;
+		if (*text == ':') {
+			if (sscanf(text + 1, "%2d%n", &second, &length) != 1 ||
+				length != 2) {
+				return false;
+			}
+			text += 1 + length;
+		}
+	}
+	if (*text == 'Z') {
+		text++;
+	}
+	if (*text != '\0' || month < 1 || month > 12 || day < 1 || day > 31 ||
+		hour > 23 || minute > 59 || second > 60) {
+		return false;
+	}
+	ms = ((civil::days_from_civil(year, month, day) * 24 + hour) * 60 +
+			minute) * 60000 + second * 1000;
+	return true;
 }
 
 int showUsage(const char *execPath)
@@ -635,18 +2921,160 @@ int showUsage(const char *execPath)
 			"OPTIONS:\n"
 			"\t-h   - show this help\n"
 			"\t-m   - display messages instead of contacts\n"
-			"\t-csv - display messages in CSV format\n\n"
+			"\t-csv - display the records in CSV format\n"
+			"\t-json - display the records as JSON, one object per line\n"
+			"\t-arrow - write the messages as an Apache Arrow IPC stream\n"
+			"\t-sqlite FILE - load the messages and the contacts into a new\n"
+			"\t       SQLite database, along with a table of the conversations\n"
+			"\t-archive FILE - write the messages to a new archive, indexed by\n"
+			"\t       conversation and by time, to be read with -query\n"
+			"\t-zstd - with -archive, compress the message contents with a\n"
+			"\t       dictionary trained on the first ones\n"
+			"\t-query - read the messages from the archive at LEVELDB_PATH\n"
+			"\t-conversation ID - with -query, only the messages of the\n"
+			"\t       conversation ID\n"
+			"\t-from TIME, -to TIME - with -query, only the messages created\n"
+			"\t       at or after -from and before -to; a TIME is YYYY-MM-DD,\n"
+			"\t       YYYY-MM-DDTHH:MM[:SS] in UTC or milliseconds since the epoch\n"
+			"\t-raw - display all the fields of the contacts, not only the\n"
+			"\t       known ones\n"
+			"\t-epoch-ms - write the message times as milliseconds since the\n"
+			"\t       epoch\n"
+			"\t-tz NAME - write the message times in a time zone of the system\n"
+			"\t       zoneinfo database, such as Europe/Bucharest (default UTC)\n"
+			"\t-j N - scan using N threads, 0 for one per CPU (default 1)\n"
+			"\t-p N - read on one thread and parse using N threads, 0 for one\n"
+			"\t       per CPU\n"
+			"\t-depth N - skip the raw records nested deeper than N levels\n"
+			"\t       (default 256)\n"
+			"\t-stats - print allocation statistics at the end\n\n"
 			"EXAMPLE:\n"
 			"\t%s ~/.config/skypeforlinux/IndexedDB/file__0.indexeddb.leveldb\n",
 			baseName, baseName);
 	return 1;
 }
 
+// object stores of the Skype IndexedDB database holding the records we show
+static const int64_t skypeDatabaseId = 1;
+static const int64_t msgObjectStoreIds[] = {1, 2, 4};
+static const int64_t contactObjectStoreId = 6;
+
 static const leveldb::Slice contactPrefixKeySlice("\x00\x01\x06\x01\x01", 5);
 static const leveldb::Slice msgPrefixKeySlice1("\x00\x01\x02\x01\x01\x24\x00", 7);
 static const leveldb::Slice msgPrefixKeySlice2("\x00\x01\x01\x01\x04\x02\x01", 7);
 static const leveldb::Slice msgPrefixKeySlice3("\x00\x01\x04\x01\x01", 5);
 
+// Formats the records found by the scan, each scanning thread has its own
+// copy. flush() is called when the output of the scan, or of the piece of
+// it scanned by a thread, is complete, the rows collected for the -arrow
+// output are written as a record batch then.
+class RecordPrinter
+{
+public:
+	RecordPrinter(bool showMessages, OutputFormat format, bool epochMs,
+				  bool showRawContacts, size_t maxDepth) :
+			showMessages_(showMessages), format_(format), epochMs_(epochMs),
+			showRawContacts_(showRawContacts), maxDepth_(maxDepth),
+			batch_(message_arrow_columns())
+	{
+	}
+
+	void operator()(output::OutputBuffer &ostr, leveldb::Slice key,
+					leveldb::Slice value);
+
+	void flush(output::OutputBuffer &ostr)
+	{
+		batch_.write(ostr);
+	}
+
+private:
+	bool showMessages_;
+	OutputFormat format_;
+	bool epochMs_;
+	bool showRawContacts_;
+	size_t maxDepth_;
+	arrow_ipc::RecordBatchBuilder batch_;
+};
+
+void RecordPrinter::operator()(output::OutputBuffer &ostr, leveldb::Slice key,
+							   leveldb::Slice value)
+{
+	static thread_local arena::RecordArena recordArena;
+	parse_result::ArenaScope arenaScope(recordArena);
+
+#if PRINT_DEBUG_DETAILS
+	printf("key:  ");
+	printSlice(key);
+	printf("\n");
+	printf("data: ");
+	printSlice(value);
+	printf("\nsummary: ");
+	printSliceSummary(key);
+	printf("\n\n");
+#endif
+
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(value.data());
+	if (format_ == OutputFormat::Sqlite || format_ == OutputFormat::Archive) {
+		// the archive scans only the messages, its rows are those of the
+		// messages table
+		if (key.starts_with(contactPrefixKeySlice)) {
+			SkypeContact contact;
+			if (decode_skype_contact_blob(data, value.size(), contact)) {
+				write_skype_contact_row(ostr, ContactsTable, contact);
+			}
+		} else if (key.starts_with(msgPrefixKeySlice1) ||
+				   key.starts_with(msgPrefixKeySlice2) ||
+				   key.starts_with(msgPrefixKeySlice3)) {
+			SkypeMessage message;
+			if (decode_skype_message_blob(data, value.size(), message)) {
+				write_skype_message_row(ostr, MessagesTable, message);
+			}
+		}
+		return;
+	}
+
+	if (showMessages_) {
+		if (!key.starts_with(msgPrefixKeySlice1) &&
+			!key.starts_with(msgPrefixKeySlice2) &&
+			!key.starts_with(msgPrefixKeySlice3)) {
+			return;
+		}
+		if (format_ != OutputFormat::Arrow) {
+			show_skype_message_blob(ostr, data, value.size(), format_,
+									epochMs_);
+			return;
+		}
+		SkypeMessage message;
+		if (decode_skype_message_blob(data, value.size(), message)) {
+			append_skype_message_row(batch_, message);
+			if (batch_.endRow()) {
+				batch_.write(ostr);
+			}
+		}
+		return;
+	}
+
+	if (!key.starts_with(contactPrefixKeySlice)) {
+		return;
+	}
+	if (!showRawContacts_) {
+		show_skype_contact_blob(ostr, data, value.size(), format_);
+		return;
+	}
+
+	// the whole record, through the generic Value tree
+	auto v = parse_skype_contact_blob(data, value.size(), maxDepth_);
+	if (!v) {
+		count_skipped_record(v.error);
+		return;
+	}
+
+	using parse_result::Visitor;
+	ostr << "BEGIN Contact -----\n";
+	std::visit(Visitor(ostr), v.value.vt_);
+	ostr << "END Contact -----\n";
+}
+
 int main(int argc, char *argv[])
 {
 	using leveldb::Slice;
@@ -655,12 +3083,71 @@ int main(int argc, char *argv[])
 	bool showHelp = (argc < 2);
 	bool showMessages = false;
 	bool useCsvFormat = false;
+	bool useJsonFormat = false;
+	bool useArrowFormat = false;
+	const char *sqlitePath = nullptr;
+	const char *archivePath = nullptr;
+	bool compressArchive = false;
+	bool queryArchive = false;
+	std::optional<std::string_view> conversation;
+	std::optional<int64_t> from;
+	std::optional<int64_t> to;
+	bool showRawContacts = false;
+	bool epochMs = false;
+	const char *timeZoneName = nullptr;
+	unsigned threadCount = 1;
+	unsigned parserCount = 0;
+	bool showStats = false;
+	size_t maxDepth = parsers::defaultMaxDepth;
 	const char *dbPath = nullptr;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-m") == 0) {
 			showMessages = true;
 		} else if (strcmp(argv[i], "-csv") == 0) {
 			useCsvFormat = true;
+		} else if (strcmp(argv[i], "-json") == 0) {
+			useJsonFormat = true;
+		} else if (strcmp(argv[i], "-arrow") == 0) {
+			useArrowFormat = true;
+		} else if (strcmp(argv[i], "-sqlite") == 0 && i + 1 < argc) {
+			sqlitePath = argv[++i];
+		} else if (strcmp(argv[i], "-archive") == 0 && i + 1 < argc) {
+			archivePath = argv[++i];
+		} else if (strcmp(argv[i], "-zstd") == 0) {
+			compressArchive = true;
+		} else if (strcmp(argv[i], "-query") == 0) {
+			queryArchive = true;
+		} else if (strcmp(argv[i], "-conversation") == 0 && i + 1 < argc) {
+			conversation = argv[++i];
+		} else if ((strcmp(argv[i], "-from") == 0 ||
+					strcmp(argv[i], "-to") == 0) && i + 1 < argc) {
+			int64_t ms;
+			if (!parse_time_argument(argv[i + 1], ms)) {
+				fprintf(stderr, "Bad time for %s: %s\n", argv[i], argv[i + 1]);
+				return 1;
+			}
+			(argv[i][1] == 'f' ? from : to) = ms;
+			++i;
+		} else if (strcmp(argv[i], "-raw") == 0) {
+			showRawContacts = true;
+		} else if (strcmp(argv[i], "-epoch-ms") == 0) {
+			epochMs = true;
+		} else if (strcmp(argv[i], "-tz") == 0 && i + 1 < argc) {
+			timeZoneName = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threadCount = (unsigned) strtoul(argv[++i], nullptr, 10);
+			if (threadCount == 0) {
+				threadCount = std::max(1u, std::thread::hardware_concurrency());
+			}
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			parserCount = (unsigned) strtoul(argv[++i], nullptr, 10);
+			if (parserCount == 0) {
+				parserCount = std::max(1u, std::thread::hardware_concurrency());
+			}
+		} else if (strcmp(argv[i], "-depth") == 0 && i + 1 < argc) {
+			maxDepth = (size_t) strtoul(argv[++i], nullptr, 10);
+		} else if (strcmp(argv[i], "-stats") == 0) {
+			showStats = true;
 		} else if (strcmp(argv[i], "-h") == 0) {
 			showHelp = true;
 		} else {
@@ -672,48 +3159,134 @@ int main(int argc, char *argv[])
 		return showUsage(argv[0]);
 	}
 
-	auto scanFunction = [showMessages, useCsvFormat](Slice key, Slice value) {
-
-#if PRINT_DEBUG_DETAILS
-		printf("key:  ");
-		printSlice(key);
-		printf("\n");
-		printf("data: ");
-		printSlice(value);
-		printf("\nsummary: ");
-		printSliceSummary(key);
-		printf("\n\n");
-#endif
+	static civil::TimeZone zone;
+	if (timeZoneName) {
+		std::string error;
+		if (!zone.load(timeZoneName, error)) {
+			fprintf(stderr, "Time zone error: %s\n", error.c_str());
+			return 1;
+		}
+		timeZone = &zone;
+	}
 
-		if (showMessages) {
-			if (key.starts_with(msgPrefixKeySlice1) ||
-				key.starts_with(msgPrefixKeySlice2) ||
-				key.starts_with(msgPrefixKeySlice3)) {
-				auto formatedMsg = show_skype_message_blob(
-						reinterpret_cast<const uint8_t *>(value.data()),
-						value.size(), useCsvFormat);
-				if (!formatedMsg.empty()) {
-					std::cout << formatedMsg << '\n';
-					if (!useCsvFormat) {
-						std::cout << '\n';
-					}
-				}
-			}
-			return;
+	if (queryArchive) {
+		const OutputFormat format = useArrowFormat ? OutputFormat::Arrow :
+				useJsonFormat ? OutputFormat::Json :
+				useCsvFormat ? OutputFormat::Csv : OutputFormat::Text;
+		output::OutputBuffer out(STDOUT_FILENO);
+		bool ok = query_message_archive(out, dbPath, conversation, from, to,
+										format, epochMs);
+		if (!out.flush()) {
+			fprintf(stderr, "Error writing the output\n");
+			ok = false;
 		}
+		return ok ? 0 : 1;
+	}
 
-		if (key.starts_with(contactPrefixKeySlice)) {
-			auto v = parse_skype_contact_blob(
-					reinterpret_cast<const uint8_t *>(value.data()),
-					value.size());
+	if (compressArchive && !archivePath) {
+		fprintf(stderr, "-zstd is only supported with -archive\n");
+		return 1;
+	}
+	if (useArrowFormat && !showMessages) {
+		fprintf(stderr, "-arrow is only supported for the messages (-m)\n");
+		return 1;
+	}
 
-			auto &ostr = std::cout;
-			using parse_result::Visitor;
-			ostr << "BEGIN Contact -----\n";
-			std::visit(Visitor(ostr), v.vt_);
-			ostr << "END Contact -----\n";
+	const OutputFormat format = sqlitePath ? OutputFormat::Sqlite :
+			archivePath ? OutputFormat::Archive :
+			useArrowFormat ? OutputFormat::Arrow :
+			useJsonFormat ? OutputFormat::Json :
+			useCsvFormat ? OutputFormat::Csv : OutputFormat::Text;
+	RecordPrinter scanFunction(showMessages, format, epochMs, showRawContacts,
+							   maxDepth);
+
+	// -sqlite loads both the messages and the contacts, -archive only holds
+	// the messages
+	const bool scanMessages = showMessages || format == OutputFormat::Sqlite ||
+			format == OutputFormat::Archive;
+	const bool scanContacts = !scanMessages || format == OutputFormat::Sqlite;
+	std::vector<KeyRange> ranges;
+	if (scanMessages) {
+		for (int64_t objectStoreId : msgObjectStoreIds) {
+			ranges.push_back(object_store_range(skypeDatabaseId, objectStoreId));
 		}
-	};
+	}
+	if (scanContacts) {
+		ranges.push_back(
+				object_store_range(skypeDatabaseId, contactObjectStoreId));
+	}
+
+	// the rows for -sqlite and -archive are stored as the buffer fills up,
+	// on this thread, in key order like the text
+	sqlite_export::SqliteLoader loader;
+	if (sqlitePath && !loader.open(sqlitePath, sql_tables())) {
+		fprintf(stderr, "SQLite error: %s\n", loader.error().c_str());
+		return 1;
+	}
+	archive::ArchiveWriter archiveWriter;
+	if (archivePath && !archiveWriter.open(archivePath,
+			message_archive_columns(), archiveKeyColumn, archiveTimeColumn,
+			compressArchive ? (int) archiveContentColumn : -1)) {
+		fprintf(stderr, "Archive error: %s\n", archiveWriter.error().c_str());
+		return 1;
+	}
+	output::OutputBuffer out = sqlitePath ?
+			output::OutputBuffer([&loader](const char *data, size_t size) {
+				return loader.load(data, size);
+			}) : archivePath ?
+			output::OutputBuffer([&archiveWriter](const char *data,
+												  size_t size) {
+				return archiveWriter.load(data, size);
+			}) :
+			output::OutputBuffer(STDOUT_FILENO);
+	if (format == OutputFormat::Arrow) {
+		arrow_ipc::write_schema(out, message_arrow_columns());
+	}
+	bool ok;
+	if (threadCount > 1) {
+		ok = scan_leveldb_parallel(dbPath, ranges, threadCount, out,
+								   scanFunction);
+	} else if (parserCount > 0) {
+		ok = scan_leveldb_pipeline(dbPath, ranges, parserCount, out,
+								   scanFunction);
+	} else {
+		ok = scan_leveldb(dbPath, ranges, out, scanFunction);
+	}
+	if (format == OutputFormat::Arrow) {
+		arrow_ipc::write_end_of_stream(out);
+	}
+	bool written = out.flush();
+	if (written && ok && sqlitePath) {
+		written = loader.finish(sql_finish_statements());
+	} else if (written && ok && archivePath) {
+		written = archiveWriter.finish();
+	}
+	if (!written) {
+		if (sqlitePath) {
+			fprintf(stderr, "SQLite error: %s\n", loader.error().c_str());
+		} else if (archivePath) {
+			fprintf(stderr, "Archive error: %s\n",
+					archiveWriter.error().c_str());
+		} else {
+			fprintf(stderr, "Error writing the output\n");
+		}
+		ok = false;
+	}
 
-	return scan_leveldb(dbPath, scanFunction) ? 0 : 1;
+	if (showStats) {
+		const arena::ArenaStats stats = arena::global_arena_stats();
+		fprintf(stderr, "records: %" PRIu64 "\n"
+				"arena allocations: %" PRIu64 "\n"
+				"heap allocations: %" PRIu64 " (%" PRIu64 " bytes)\n",
+				stats.records, stats.allocations, stats.heapAllocations,
+				stats.heapBytes);
+		if (compressArchive) {
+			fprintf(stderr, "archive dictionary: %" PRIu64 " bytes\n"
+					"archive contents: %" PRIu64 " bytes, %" PRIu64
+					" stored\n", archiveWriter.dictionarySize(),
+					archiveWriter.plainBytes(), archiveWriter.storedBytes());
+		}
+	}
+	print_skipped_records();
+	return ok ? 0 : 1;
 }
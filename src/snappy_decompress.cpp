@@ -0,0 +1,121 @@
+/*
+ * snappy_decompress.cpp - decompress raw Snappy blocks
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "snappy_decompress.h"
+
+#include "varint.h"
+
+#include <cstring>
+
+namespace compression {
+
+namespace {
+
+// The 2 low bits of the tag of an element give its type.
+enum ElementType {
+	Literal = 0,
+	Copy1ByteOffset = 1,
+	Copy2ByteOffset = 2,
+	Copy4ByteOffset = 3
+};
+
+// no element expands more than this, a copy of 64 bytes takes 3
+const size_t maxExpansion = 22;
+
+inline uint32_t load_le(const uint8_t *p, size_t n)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < n; ++i) {
+		value |= (uint32_t) p[i] << (8 * i);
+	}
+	return value;
+}
+
+} // namespace
+
+bool snappy_uncompress(const uint8_t *data, size_t size, std::string &output)
+{
+	const uint8_t *p = data;
+	const uint8_t *const pend = data + size;
+
+	uint64_t length;
+	if (!varint::decode(&p, pend, &length) ||
+		length > (uint64_t) (pend - p) * maxExpansion) {
+		return false;
+	}
+	output.resize(length);
+	uint8_t *const out = reinterpret_cast<uint8_t *>(&output[0]);
+	size_t pos = 0;
+
+	while (p < pend) {
+		const uint8_t tag = *p++;
+		size_t len, offset;
+		switch (tag & 3) {
+		case Literal:
+			len = tag >> 2;
+			if (len >= 60) {
+				// the length minus 1 follows in 1 to 4 bytes
+				const size_t n = len - 59;
+				if ((size_t) (pend - p) < n) {
+					return false;
+				}
+				len = load_le(p, n);
+				p += n;
+			}
+			len++;
+			if ((size_t) (pend - p) < len || length - pos < len) {
+				return false;
+			}
+			memcpy(out + pos, p, len);
+			p += len;
+			pos += len;
+			continue;
+		case Copy1ByteOffset:
+			if (p == pend) {
+				return false;
+			}
+			len = 4 + ((tag >> 2) & 7);
+			offset = ((size_t) (tag >> 5) << 8) | *p++;
+			break;
+		case Copy2ByteOffset:
+			if (pend - p < 2) {
+				return false;
+			}
+			len = 1 + (tag >> 2);
+			offset = load_le(p, 2);
+			p += 2;
+			break;
+		default:
+			if (pend - p < 4) {
+				return false;
+			}
+			len = 1 + (tag >> 2);
+			offset = load_le(p, 4);
+			p += 4;
+			break;
+		}
+
+		if (offset == 0 || offset > pos || length - pos < len) {
+			return false;
+		}
+		uint8_t *dst = out + pos;
+		const uint8_t *src = dst - offset;
+		if (offset >= len) {
+			memcpy(dst, src, len);
+		} else {
+			// the copy overlaps what it writes, repeating a pattern
+			for (size_t i = 0; i < len; ++i) {
+				dst[i] = src[i];
+			}
+		}
+		pos += len;
+	}
+	return pos == length;
+}
+
+} /* namespace compression */
@@ -0,0 +1,26 @@
+/*
+ * snappy_decompress.h - decompress raw Snappy blocks
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_SNAPPY_DECOMPRESS_H_
+#define SRC_SNAPPY_DECOMPRESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace compression {
+
+// Decompress a raw Snappy block, as written by snappy::Compress() (not the
+// framing format), into `output`, which is resized so its memory can be
+// reused from one call to the next. Returns false if the block is corrupt,
+// never reading or writing out of bounds.
+bool snappy_uncompress(const uint8_t *data, size_t size, std::string &output);
+
+} /* namespace compression */
+
+#endif /* SRC_SNAPPY_DECOMPRESS_H_ */
@@ -0,0 +1,230 @@
+/*
+ * sqlite_export.cpp - bulk load the records into an SQLite database
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "sqlite_export.h"
+
+#ifdef HAVE_SQLITE3
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sqlite3.h>
+#include <unistd.h>
+#endif
+
+namespace sqlite_export {
+
+#ifdef HAVE_SQLITE3
+
+namespace {
+
+// Tuned for one load into a new file: large pages and cache, nothing
+// written twice through a journal, no fsync() and the temporary b-trees of
+// the index creation kept in memory.
+const char *const loadPragmas[] = {
+	"PRAGMA page_size = 65536",
+	"PRAGMA journal_mode = OFF",
+	"PRAGMA synchronous = OFF",
+	"PRAGMA locking_mode = EXCLUSIVE",
+	"PRAGMA temp_store = MEMORY",
+	"PRAGMA cache_size = -262144" // KiB
+};
+
+void append_quoted_name(std::string &sql, std::string_view name)
+{
+	sql += '"';
+	sql.append(name.data(), name.size());
+	sql += '"';
+}
+
+} // namespace
+
+SqliteLoader::~SqliteLoader()
+{
+	for (sqlite3_stmt *insert : inserts_) {
+		sqlite3_finalize(insert);
+	}
+	sqlite3_close(db_);
+	// without a journal a load which failed can't be rolled back, what was
+	// written of it is of no use
+	if (!path_.empty() && !finished_) {
+		unlink(path_.c_str());
+	}
+}
+
+bool SqliteLoader::open(const char *path, const std::vector<Table> &tables)
+{
+	// The pragmas would make an existing database unsafe to write to, the
+	// file is created here so that one is never opened. SQLite takes an
+	// empty file for a new database.
+	const int fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		error_ = std::string(path) + ": " + strerror(errno);
+		return false;
+	}
+	close(fd);
+	path_ = path;
+	if (sqlite3_open_v2(path, &db_, SQLITE_OPEN_READWRITE,
+						nullptr) != SQLITE_OK) {
+		return fail("Opening the database");
+	}
+	for (const char *pragma : loadPragmas) {
+		if (!execute(pragma)) {
+			return false;
+		}
+	}
+
+	for (const Table &table : tables) {
+		std::string create = "CREATE TABLE ";
+		std::string insert = "INSERT INTO ";
+		append_quoted_name(create, table.name);
+		append_quoted_name(insert, table.name);
+		std::string values;
+		char separator = '(';
+		for (const Column &column : table.columns) {
+			create += separator;
+			insert += separator;
+			values += separator;
+			separator = ',';
+			append_quoted_name(create, column.name);
+			append_quoted_name(insert, column.name);
+			create += column.type == ColumnType::Text ? " TEXT" : " INTEGER";
+			values += '?';
+		}
+		create += ')';
+		insert += ") VALUES " + values + ')';
+		if (!execute(create.c_str())) {
+			return false;
+		}
+
+		sqlite3_stmt *statement = nullptr;
+		if (sqlite3_prepare_v3(db_, insert.c_str(), (int) insert.size(),
+							   SQLITE_PREPARE_PERSISTENT, &statement,
+							   nullptr) != SQLITE_OK) {
+			return fail("Preparing the inserts");
+		}
+		inserts_.push_back(statement);
+		columnCounts_.push_back(table.columns.size());
+	}
+	decoder_.emplace(columnCounts_);
+	return execute("BEGIN");
+}
+
+bool SqliteLoader::load(const char *data, size_t size)
+{
+	if (!error_.empty()) {
+		return false;
+	}
+	const bool ok = decoder_->decode(data, size,
+			[this](size_t table, const row_stream::Value *values) {
+		return insertRow(table, values);
+	});
+	if (!ok && error_.empty()) {
+		error_ = "Bad row";
+	}
+	return ok;
+}
+
+bool SqliteLoader::insertRow(size_t table, const row_stream::Value *values)
+{
+	using row_stream::Value;
+
+	sqlite3_stmt *insert = inserts_[table];
+	for (size_t i = 0; i < columnCounts_[table]; ++i) {
+		const Value &value = values[i];
+		const int index = (int) i + 1;
+		int result;
+		if (value.type == Value::Text) {
+			// the row stays in place until the statement is reset
+			result = sqlite3_bind_text(insert, index, value.text.data(),
+									   (int) value.text.size(), SQLITE_STATIC);
+		} else if (value.type == Value::Integer) {
+			result = sqlite3_bind_int64(insert, index, value.integer);
+		} else {
+			result = sqlite3_bind_null(insert, index);
+		}
+		if (result != SQLITE_OK) {
+			return fail("Binding a value");
+		}
+	}
+
+	const int result = sqlite3_step(insert);
+	sqlite3_reset(insert);
+	if (result != SQLITE_DONE) {
+		return fail("Inserting a row");
+	}
+	rows_++;
+	if (++transactionSize_ == transactionRows) {
+		transactionSize_ = 0;
+		return execute("COMMIT") && execute("BEGIN");
+	}
+	return true;
+}
+
+bool SqliteLoader::finish(const std::vector<std::string> &statements)
+{
+	if (!error_.empty()) {
+		return false;
+	}
+	if (decoder_->hasPending()) {
+		error_ = "The last row is incomplete";
+		return false;
+	}
+	for (const std::string &statement : statements) {
+		if (!execute(statement.c_str())) {
+			return false;
+		}
+	}
+	finished_ = execute("COMMIT");
+	return finished_;
+}
+
+bool SqliteLoader::execute(const char *sql)
+{
+	char *message = nullptr;
+	if (sqlite3_exec(db_, sql, nullptr, nullptr, &message) != SQLITE_OK) {
+		error_ = std::string(sql) + ": " +
+				(message ? message : sqlite3_errmsg(db_));
+		sqlite3_free(message);
+		return false;
+	}
+	return true;
+}
+
+bool SqliteLoader::fail(const char *what)
+{
+	error_ = std::string(what) + ": " +
+			(db_ ? sqlite3_errmsg(db_) : "out of memory");
+	return false;
+}
+
+#else /* HAVE_SQLITE3 */
+
+// built without the sqlite3 library, the loader only reports it
+
+SqliteLoader::~SqliteLoader() = default;
+
+bool SqliteLoader::open(const char *, const std::vector<Table> &)
+{
+	error_ = "this build has no SQLite support, the sqlite3 library was "
+			"missing";
+	return false;
+}
+
+bool SqliteLoader::load(const char *, size_t)
+{
+	return false;
+}
+
+bool SqliteLoader::finish(const std::vector<std::string> &)
+{
+	return false;
+}
+
+#endif /* HAVE_SQLITE3 */
+
+} /* namespace sqlite_export */
@@ -0,0 +1,97 @@
+/*
+ * sqlite_export.h - bulk load the records into an SQLite database
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_SQLITE_EXPORT_H_
+#define SRC_SQLITE_EXPORT_H_
+
+#include "row_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// The records are encoded with row_stream into the output buffers, then
+// inserted by a single SqliteLoader the buffers are handed to.
+namespace sqlite_export {
+
+enum class ColumnType {
+	Text,
+	Integer
+};
+
+struct Column
+{
+	std::string_view name;
+	ColumnType type;
+};
+
+struct Table
+{
+	std::string_view name;
+	std::vector<Column> columns;
+};
+
+// Creates the tables in a new database and inserts the rows, with prepared
+// statements in large transactions. The database is set up for a one-shot
+// load: without a journal and without syncing the file, so nothing can be
+// rolled back. The database is deleted when the load fails, a process killed
+// before finish() leaves one to be deleted. The indexes are created by
+// finish(), once the rows are all there.
+class SqliteLoader
+{
+public:
+	// rows inserted per transaction
+	static constexpr size_t transactionRows = 256 * 1024;
+
+	SqliteLoader() = default;
+	~SqliteLoader();
+
+	SqliteLoader(const SqliteLoader &) = delete;
+	SqliteLoader &operator=(const SqliteLoader &) = delete;
+
+	// Create the database file at `path`, which shouldn't exist yet, with
+	// the given tables. False on error, see error().
+	bool open(const char *path, const std::vector<Table> &tables);
+
+	// Insert the rows encoded in `data`, the rows of the table number n of
+	// open(). The rows can be split anywhere between the calls.
+	bool load(const char *data, size_t size);
+
+	// Create the indexes, run the statements which fill the derived tables,
+	// then commit. Each string is a complete SQL statement.
+	bool finish(const std::vector<std::string> &statements);
+
+	uint64_t rows() const { return rows_; }
+
+	const std::string &error() const { return error_; }
+
+private:
+	bool insertRow(size_t table, const row_stream::Value *values);
+	bool execute(const char *sql);
+	bool fail(const char *what);
+
+	std::string path_; // of the file created by open()
+	bool finished_ = false;
+	sqlite3 *db_ = nullptr;
+	std::vector<sqlite3_stmt *> inserts_; // one per table
+	std::vector<size_t> columnCounts_;
+	std::optional<row_stream::RowDecoder> decoder_;
+	uint64_t rows_ = 0;
+	size_t transactionSize_ = 0;
+	std::string error_;
+};
+
+} /* namespace sqlite_export */
+
+#endif /* SRC_SQLITE_EXPORT_H_ */
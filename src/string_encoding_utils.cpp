@@ -1,5 +1,5 @@
 /*
- * string_encoding_utils.cpp - convert ISO-8859-1 to UTF-8
+ * string_encoding_utils.cpp - convert ISO-8859-1 and UTF-16 to UTF-8
  *
  *  Created on: Jun 7, 2021
  *      Author: Robert
@@ -8,6 +8,12 @@
  */
 #include "string_encoding_utils.h"
 
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace cp {
 
 
@@ -66,19 +72,500 @@ static size_t unicode_to_utf8(uint32_t uc, char utfbuffer[8])
 	return count;
 }
 
-std::string convert_iso8859_to_utf8(const uint8_t *data, size_t length)
+namespace {
+
+// UTF-8 encoding of the bytes 0x80 - 0xff
+struct HighByteUtf8
 {
-	std::string result;
+	char bytes[4];
+	size_t length;
+};
+
+struct HighByteTable
+{
+	HighByteUtf8 entries[128];
+
+	HighByteTable()
+	{
+		for (size_t i = 0; i < 128; ++i) {
+			char utfbuffer[8] = {};
+			entries[i].length = unicode_to_utf8(cp_iso8859_1[i], utfbuffer);
+			memcpy(entries[i].bytes, utfbuffer, sizeof(entries[i].bytes));
+		}
+	}
+};
+
+const HighByteTable highBytes;
+
+// The vectorized converters may store up to this many bytes past the end of
+// their output, and a high byte is written as 4 bytes of which up to 3 are
+// used.
+const size_t outputSlack = 32;
+
+size_t convert_scalar(const uint8_t *data, size_t length, char *out)
+{
+	char *o = out;
 	for (size_t i = 0; i != length; ++i) {
 		if (data[i] < 0x80) {
-			result.append(1u, static_cast<char>(data[i]));
+			*o++ = static_cast<char>(data[i]);
+		} else {
+			const HighByteUtf8 &u = highBytes.entries[data[i] - 0x80];
+			memcpy(o, u.bytes, sizeof(u.bytes));
+			o += u.length;
+		}
+	}
+	return o - out;
+}
+
+inline uint32_t utf16le_unit(const uint8_t *data, size_t i)
+{
+	return data[2 * i] | (data[2 * i + 1] << 8);
+}
+
+// Convert the UTF-16 code unit at data[i], or the surrogate pair starting
+// there, and return the number of code units consumed. Unpaired surrogates
+// become U+FFFD.
+inline size_t convert_utf16le_char(const uint8_t *data, size_t i,
+								   size_t units, char *&o)
+{
+	const uint32_t u = utf16le_unit(data, i);
+	if (u < 0x80) {
+		*o++ = static_cast<char>(u);
+		return 1;
+	}
+	if (u < 0x800) {
+		*o++ = static_cast<char>(0xC0 | (u >> 6));
+		*o++ = static_cast<char>(0x80 | (u & 0x3F));
+		return 1;
+	}
+
+	uint32_t uc = u;
+	size_t consumed = 1;
+	if (u >= 0xD800 && u <= 0xDFFF) {
+		const uint32_t next = (i + 1 < units) ? utf16le_unit(data, i + 1) : 0;
+		if (u <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF) {
+			uc = 0x10000 + ((u - 0xD800) << 10) + (next - 0xDC00);
+			consumed = 2;
+		} else {
+			uc = 0xFFFD;
+		}
+	}
+
+	if (uc < 0x10000) {
+		*o++ = static_cast<char>(0xE0 | (uc >> 12));
+	} else {
+		*o++ = static_cast<char>(0xF0 | (uc >> 18));
+		*o++ = static_cast<char>(0x80 | ((uc >> 12) & 0x3F));
+	}
+	*o++ = static_cast<char>(0x80 | ((uc >> 6) & 0x3F));
+	*o++ = static_cast<char>(0x80 | (uc & 0x3F));
+	return consumed;
+}
+
+size_t convert_utf16le_scalar(const uint8_t *data, size_t units, char *out)
+{
+	char *o = out;
+	for (size_t i = 0; i < units;) {
+		i += convert_utf16le_char(data, i, units, o);
+	}
+	return o - out;
+}
+
+#if defined(__SSE2__)
+
+// upper bound of the UTF-8 length: every high byte takes at most 3 bytes
+size_t utf8_length_bound(const uint8_t *data, size_t length)
+{
+	size_t highCount = 0;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + i));
+		highCount += __builtin_popcount(_mm_movemask_epi8(in));
+	}
+	for (; i < length; ++i) {
+		highCount += data[i] >> 7;
+	}
+	return length + 2 * highCount;
+}
+
+size_t convert_sse2(const uint8_t *data, size_t length, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + i));
+		if (_mm_movemask_epi8(in) == 0) {
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(o), in);
+			o += 16;
+		} else {
+			o += convert_scalar(data + i, 16, o);
+		}
+	}
+	return (o - out) + convert_scalar(data + i, length - i, o);
+}
+
+// pshufb masks keeping the lead byte of each of 8 (lead, trail) pairs and
+// the trail byte only for the high bytes, indexed by the high byte mask
+struct CompactTable
+{
+	alignas(16) uint8_t shuffles[256][16];
+	uint8_t lengths[256];
+
+	CompactTable()
+	{
+		for (unsigned mask = 0; mask < 256; ++mask) {
+			unsigned n = 0;
+			for (unsigned i = 0; i < 8; ++i) {
+				shuffles[mask][n++] = 2 * i;
+				if (mask & (1u << i)) {
+					shuffles[mask][n++] = 2 * i + 1;
+				}
+			}
+			lengths[mask] = n;
+			while (n < 16) {
+				shuffles[mask][n++] = 0x80;
+			}
+		}
+	}
+};
+
+const CompactTable compactTable;
+
+// Convert 16 bytes which are either ASCII or in 0xa0 - 0xff, where Latin-1
+// and Unicode agree, to 2 byte sequences: 0xc2/0xc3 followed by 0x80 | b.
+// always inlined, so that it is VEX encoded in convert_avx2() and there are
+// no SSE / AVX transition stalls
+__attribute__((target("ssse3"), always_inline))
+inline size_t convert16_ssse3(__m128i in, unsigned mask, char *out)
+{
+	const __m128i high = _mm_cmplt_epi8(in, _mm_setzero_si128());
+	const __m128i lead = _mm_or_si128(
+			_mm_and_si128(_mm_srli_epi16(in, 6), _mm_set1_epi8(0x03)),
+			_mm_set1_epi8((char) 0xc0));
+	const __m128i trail = _mm_or_si128(_mm_and_si128(in, _mm_set1_epi8(0x3f)),
+									   _mm_set1_epi8((char) 0x80));
+	const __m128i first = _mm_or_si128(_mm_and_si128(high, lead),
+									   _mm_andnot_si128(high, in));
+
+	const unsigned lowMask = mask & 0xff;
+	const unsigned highMask = mask >> 8;
+	const __m128i lowPairs = _mm_unpacklo_epi8(first, trail);
+	const __m128i highPairs = _mm_unpackhi_epi8(first, trail);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+			_mm_shuffle_epi8(lowPairs, _mm_load_si128(
+					reinterpret_cast<const __m128i *>(
+							compactTable.shuffles[lowMask]))));
+	out += compactTable.lengths[lowMask];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+			_mm_shuffle_epi8(highPairs, _mm_load_si128(
+					reinterpret_cast<const __m128i *>(
+							compactTable.shuffles[highMask]))));
+	return compactTable.lengths[lowMask] + compactTable.lengths[highMask];
+}
+
+__attribute__((target("ssse3"), always_inline))
+inline size_t convert_chunk_ssse3(const uint8_t *data, char *out)
+{
+	const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+	const unsigned mask = _mm_movemask_epi8(in);
+	if (mask == 0) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), in);
+		return 16;
+	}
+
+	// 0x80 - 0x9f are the Windows-1252 characters, seldom used
+	const __m128i c1 = _mm_cmplt_epi8(in, _mm_set1_epi8((char) 0xa0));
+	if (_mm_movemask_epi8(c1) & mask) {
+		return convert_scalar(data, 16, out);
+	}
+	return convert16_ssse3(in, mask, out);
+}
+
+__attribute__((target("ssse3")))
+size_t convert_ssse3(const uint8_t *data, size_t length, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		o += convert_chunk_ssse3(data + i, o);
+	}
+	return (o - out) + convert_scalar(data + i, length - i, o);
+}
+
+__attribute__((target("avx2")))
+size_t convert_avx2(const uint8_t *data, size_t length, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		const __m256i in = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(data + i));
+		if (_mm256_movemask_epi8(in) == 0) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(o), in);
+			o += 32;
 		} else {
-			char utfbuffer[8];
-			const size_t n =
-					unicode_to_utf8(cp_iso8859_1[data[i] - 0x80], utfbuffer);
-			result.append(utfbuffer, n);
+			o += convert_chunk_ssse3(data + i, o);
+			o += convert_chunk_ssse3(data + i + 16, o);
 		}
 	}
+	for (; i + 16 <= length; i += 16) {
+		o += convert_chunk_ssse3(data + i, o);
+	}
+	return (o - out) + convert_scalar(data + i, length - i, o);
+}
+
+// Encode 4 code points, zero extended to 32 bits, each into the bytes of its
+// lane, and return the number of bytes of each lane. The lanes where `pair`
+// holds the low surrogate following a high surrogate get the code point of
+// the pair, those of `skip` are the low surrogates of the pairs, of length 0.
+inline __m128i encode4_utf16le_sse2(__m128i c, __m128i pair, __m128i skip,
+									__m128i &bytes)
+{
+	const __m128i isPair = _mm_cmpgt_epi32(pair, _mm_setzero_si128());
+	// ((high - 0xd800) << 10) + (low - 0xdc00) + 0x10000
+	const __m128i paired = _mm_sub_epi32(
+			_mm_add_epi32(_mm_slli_epi32(c, 10), pair),
+			_mm_set1_epi32(0x35fdc00));
+	c = _mm_or_si128(_mm_and_si128(isPair, paired),
+					 _mm_andnot_si128(isPair, c));
+
+	const __m128i mask6 = _mm_set1_epi32(0x3f);
+	const __m128i cont = _mm_set1_epi32(0x80);
+	const __m128i t0 = _mm_or_si128(_mm_and_si128(c, mask6), cont);
+	const __m128i t1 = _mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(c, 6), mask6), cont);
+	const __m128i t2 = _mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(c, 12), mask6), cont);
+	const __m128i two = _mm_or_si128(
+			_mm_or_si128(_mm_srli_epi32(c, 6), _mm_set1_epi32(0xc0)),
+			_mm_slli_epi32(t0, 8));
+	const __m128i three = _mm_or_si128(
+			_mm_or_si128(_mm_srli_epi32(c, 12), _mm_set1_epi32(0xe0)),
+			_mm_or_si128(_mm_slli_epi32(t1, 8), _mm_slli_epi32(t0, 16)));
+	const __m128i four = _mm_or_si128(
+			_mm_or_si128(_mm_srli_epi32(c, 18), _mm_set1_epi32(0xf0)),
+			_mm_or_si128(_mm_slli_epi32(t2, 8),
+						 _mm_or_si128(_mm_slli_epi32(t1, 16),
+									  _mm_slli_epi32(t0, 24))));
+
+	const __m128i above1 = _mm_cmpgt_epi32(c, _mm_set1_epi32(0x7f));
+	const __m128i above2 = _mm_cmpgt_epi32(c, _mm_set1_epi32(0x7ff));
+	const __m128i above3 = _mm_cmpgt_epi32(c, _mm_set1_epi32(0xffff));
+	bytes = _mm_or_si128(_mm_and_si128(above1, two),
+						 _mm_andnot_si128(above1, c));
+	bytes = _mm_or_si128(_mm_and_si128(above2, three),
+						 _mm_andnot_si128(above2, bytes));
+	bytes = _mm_or_si128(_mm_and_si128(above3, four),
+						 _mm_andnot_si128(above3, bytes));
+	const __m128i length = _mm_sub_epi32(_mm_sub_epi32(_mm_sub_epi32(
+			_mm_set1_epi32(1), above1), above2), above3);
+	return _mm_andnot_si128(skip, length);
+}
+
+// Convert 8 code units of any kind, surrogate pairs included, without
+// branches: each is encoded into a 32-bit lane, then the lanes are stored
+// one after the other, each overwriting the unused bytes of the previous
+// one. A high surrogate in the last code unit is left for the next call,
+// which has its low surrogate. Returns the number of code units converted.
+inline size_t convert_utf16le8_sse2(__m128i in, char *&o)
+{
+	const __m128i kind = _mm_and_si128(in, _mm_set1_epi16((short) 0xfc00));
+	const __m128i isHigh = _mm_cmpeq_epi16(kind,
+										   _mm_set1_epi16((short) 0xd800));
+	const __m128i isLow = _mm_cmpeq_epi16(kind,
+										  _mm_set1_epi16((short) 0xdc00));
+	const __m128i pairStart = _mm_and_si128(isHigh, _mm_srli_si128(isLow, 2));
+	const __m128i pairEnd = _mm_and_si128(isLow, _mm_slli_si128(isHigh, 2));
+	// the unpaired surrogates become U+FFFD
+	const __m128i unpaired = _mm_andnot_si128(
+			_mm_or_si128(pairStart, pairEnd), _mm_or_si128(isHigh, isLow));
+	const __m128i units = _mm_or_si128(
+			_mm_andnot_si128(unpaired, in),
+			_mm_and_si128(unpaired, _mm_set1_epi16((short) 0xfffd)));
+	const __m128i pairs = _mm_and_si128(pairStart, _mm_srli_si128(in, 2));
+
+	const __m128i zero = _mm_setzero_si128();
+	alignas(16) uint32_t bytes[8];
+	alignas(16) uint32_t lengths[8];
+	__m128i encoded;
+	_mm_store_si128(reinterpret_cast<__m128i *>(lengths),
+			encode4_utf16le_sse2(_mm_unpacklo_epi16(units, zero),
+								 _mm_unpacklo_epi16(pairs, zero),
+								 _mm_unpacklo_epi16(pairEnd, pairEnd),
+								 encoded));
+	_mm_store_si128(reinterpret_cast<__m128i *>(bytes), encoded);
+	_mm_store_si128(reinterpret_cast<__m128i *>(lengths + 4),
+			encode4_utf16le_sse2(_mm_unpackhi_epi16(units, zero),
+								 _mm_unpackhi_epi16(pairs, zero),
+								 _mm_unpackhi_epi16(pairEnd, pairEnd),
+								 encoded));
+	_mm_store_si128(reinterpret_cast<__m128i *>(bytes + 4), encoded);
+
+	const size_t count = (_mm_movemask_epi8(isHigh) & 0x8000) ? 7 : 8;
+	for (size_t k = 0; k < count; ++k) {
+		memcpy(o, &bytes[k], 4);
+		o += lengths[k];
+	}
+	return count;
+}
+
+// 8 code units below 0x80 are packed to bytes as they are
+size_t convert_utf16le_sse2(const uint8_t *data, size_t units, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+	while (i + 8 <= units) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + 2 * i));
+		const __m128i nonAscii = _mm_and_si128(in, _mm_set1_epi16(-0x80));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii,
+											  _mm_setzero_si128())) == 0xffff) {
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(o),
+							 _mm_packus_epi16(in, in));
+			o += 8;
+			i += 8;
+			continue;
+		}
+		i += convert_utf16le8_sse2(in, o);
+	}
+	o += convert_utf16le_scalar(data + 2 * i, units - i, o);
+	return o - out;
+}
+
+// Convert 8 code units below 0x800 to 1 or 2 byte sequences, the same way
+// as convert16_ssse3() does with the bytes of a Latin-1 string.
+__attribute__((target("ssse3"), always_inline))
+inline size_t convert_utf16le8_ssse3(__m128i in, char *out)
+{
+	const __m128i high = _mm_cmpgt_epi16(in, _mm_set1_epi16(0x7f));
+	const __m128i lead = _mm_or_si128(_mm_srli_epi16(in, 6),
+									  _mm_set1_epi16(0xc0));
+	const __m128i trail = _mm_or_si128(_mm_and_si128(in, _mm_set1_epi16(0x3f)),
+									   _mm_set1_epi16(0x80));
+	const __m128i first = _mm_or_si128(_mm_and_si128(high, lead),
+									   _mm_andnot_si128(high, in));
+	const __m128i pairs = _mm_or_si128(first, _mm_slli_epi16(trail, 8));
+	const unsigned mask = _mm_movemask_epi8(
+			_mm_packs_epi16(high, _mm_setzero_si128())) & 0xff;
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+			_mm_shuffle_epi8(pairs, _mm_load_si128(
+					reinterpret_cast<const __m128i *>(
+							compactTable.shuffles[mask]))));
+	return compactTable.lengths[mask];
+}
+
+__attribute__((target("ssse3")))
+size_t convert_utf16le_ssse3(const uint8_t *data, size_t units, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+	while (i + 8 <= units) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + 2 * i));
+		const __m128i above2Bytes = _mm_and_si128(in, _mm_set1_epi16(-0x800));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(above2Bytes,
+											  _mm_setzero_si128())) == 0xffff) {
+			o += convert_utf16le8_ssse3(in, o);
+			i += 8;
+			continue;
+		}
+		i += convert_utf16le8_sse2(in, o);
+	}
+	o += convert_utf16le_scalar(data + 2 * i, units - i, o);
+	return o - out;
+}
+
+#else
+
+size_t utf8_length_bound(const uint8_t *data, size_t length)
+{
+	size_t highCount = 0;
+	for (size_t i = 0; i < length; ++i) {
+		highCount += data[i] >> 7;
+	}
+	return length + 2 * highCount;
+}
+
+#endif // __SSE2__
+
+using ConvertFunction = size_t (*)(const uint8_t *, size_t, char *);
+
+ConvertFunction select_convert_function()
+{
+#if defined(__SSE2__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return convert_avx2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		return convert_ssse3;
+	}
+	return convert_sse2;
+#else
+	return convert_scalar;
+#endif
+}
+
+const ConvertFunction convertFunction = select_convert_function();
+
+ConvertFunction select_convert_utf16le_function()
+{
+#if defined(__SSE2__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		return convert_utf16le_ssse3;
+	}
+	return convert_utf16le_sse2;
+#else
+	return convert_utf16le_scalar;
+#endif
+}
+
+const ConvertFunction convertUtf16leFunction =
+		select_convert_utf16le_function();
+
+} // namespace
+
+void append_iso8859_as_utf8(const uint8_t *data, size_t length,
+							std::string &result)
+{
+	const size_t offset = result.size();
+	result.resize(offset + utf8_length_bound(data, length) + outputSlack);
+	const size_t n = convertFunction(data, length, &result[offset]);
+	result.resize(offset + n);
+}
+
+std::string convert_iso8859_to_utf8(const uint8_t *data, size_t length)
+{
+	std::string result;
+	append_iso8859_as_utf8(data, length, result);
+	return result;
+}
+
+void append_utf16le_as_utf8(const uint8_t *data, size_t length,
+							std::string &result)
+{
+	const size_t units = length / 2;
+	const size_t offset = result.size();
+	// a code unit takes at most 3 bytes, a surrogate pair 4
+	result.resize(offset + 3 * units + 3 + outputSlack);
+	size_t n = convertUtf16leFunction(data, units, &result[offset]);
+	if (length % 2) {
+		// truncated code unit
+		memcpy(&result[offset + n], "\xEF\xBF\xBD", 3);
+		n += 3;
+	}
+	result.resize(offset + n);
+}
+
+std::string convert_utf16le_to_utf8(const uint8_t *data, size_t length)
+{
+	std::string result;
+	append_utf16le_as_utf8(data, length, result);
 	return result;
 }
 
@@ -1,5 +1,5 @@
 /*
- * string_encoding_utils.h - convert ISO-8859-1 to UTF-8
+ * string_encoding_utils.h - convert ISO-8859-1 and UTF-16 to UTF-8
  *
  *  Created on: Jun 7, 2021
  *      Author: Robert
@@ -16,6 +16,17 @@ namespace cp {
 
 std::string convert_iso8859_to_utf8(const uint8_t *data, size_t length);
 
+// same as convert_iso8859_to_utf8(), appending to an existing string
+void append_iso8859_as_utf8(const uint8_t *data, size_t length,
+							std::string &result);
+
+// Convert `length` bytes of UTF-16LE, which don't need to be aligned.
+// Unpaired surrogates and a truncated last code unit become U+FFFD.
+std::string convert_utf16le_to_utf8(const uint8_t *data, size_t length);
+
+void append_utf16le_as_utf8(const uint8_t *data, size_t length,
+							std::string &result);
+
 } /* namespace cp */
 
 #endif /* SRC_STRING_ENCODING_UTILS_H_ */
@@ -0,0 +1,333 @@
+/*
+ * text_escape.cpp - escape the record fields for the output formats
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#include "text_escape.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace escape {
+
+namespace {
+
+// what the quoting of a CSV field takes
+struct CsvScan
+{
+	bool needsQuotes;
+	size_t quotes;
+};
+
+inline bool is_csv_special(char c)
+{
+	return c == '"' || c == ',' || c == '\n' || c == '\r';
+}
+
+CsvScan scan_csv_scalar(const char *p, size_t n)
+{
+	CsvScan scan = {false, 0};
+	for (size_t i = 0; i < n; ++i) {
+		scan.quotes += p[i] == '"';
+		scan.needsQuotes |= is_csv_special(p[i]);
+	}
+	return scan;
+}
+
+// copy, writing every quote twice, return the end of the output
+char *copy_doubling_quotes_scalar(const char *p, size_t n, char *o)
+{
+	for (size_t i = 0; i < n; ++i) {
+		*o++ = p[i];
+		if (p[i] == '"') {
+			*o++ = '"';
+		}
+	}
+	return o;
+}
+
+#if defined(__SSE2__)
+
+CsvScan scan_csv(const char *p, size_t n)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	size_t quotes = 0;
+	unsigned special = 0;
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(p + i));
+		const __m128i isQuote = _mm_cmpeq_epi8(in, quote);
+		const __m128i isSpecial = _mm_or_si128(
+				_mm_or_si128(isQuote, _mm_cmpeq_epi8(in, comma)),
+				_mm_or_si128(_mm_cmpeq_epi8(in, lf), _mm_cmpeq_epi8(in, cr)));
+		quotes += __builtin_popcount(_mm_movemask_epi8(isQuote));
+		special |= _mm_movemask_epi8(isSpecial);
+	}
+	const CsvScan tail = scan_csv_scalar(p + i, n - i);
+	return {special != 0 || tail.needsQuotes, quotes + tail.quotes};
+}
+
+char *copy_doubling_quotes(const char *p, size_t n, char *o)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(p + i));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(in, quote));
+		if (mask == 0) {
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(o), in);
+			o += 16;
+			continue;
+		}
+		// the runs up to each quote, then the quote once more
+		size_t start = 0;
+		while (mask != 0) {
+			const size_t end = __builtin_ctz(mask) + 1;
+			memcpy(o, p + i + start, end - start);
+			o += end - start;
+			*o++ = '"';
+			start = end;
+			mask &= mask - 1;
+		}
+		memcpy(o, p + i + start, 16 - start);
+		o += 16 - start;
+	}
+	return copy_doubling_quotes_scalar(p + i, n - i, o);
+}
+
+#else
+
+CsvScan scan_csv(const char *p, size_t n)
+{
+	return scan_csv_scalar(p, n);
+}
+
+char *copy_doubling_quotes(const char *p, size_t n, char *o)
+{
+	return copy_doubling_quotes_scalar(p, n, o);
+}
+
+#endif // __SSE2__
+
+// the escape sequences of the ASCII characters, empty for the ones which
+// are written as they are
+struct JsonEscapes
+{
+	char sequences[128][7] = {};
+	uint8_t lengths[128] = {};
+
+	JsonEscapes()
+	{
+		static const char hexDigits[] = "0123456789ABCDEF";
+		for (unsigned c = 0; c < 0x20; ++c) {
+			set(c, "\\u00");
+			sequences[c][4] = hexDigits[c >> 4];
+			sequences[c][5] = hexDigits[c & 0xf];
+			lengths[c] = 6;
+		}
+		set('\b', "\\b");
+		set('\f', "\\f");
+		set('\n', "\\n");
+		set('\r', "\\r");
+		set('\t', "\\t");
+		set('\\', "\\\\");
+		set('"', "\\\"");
+		set('<', "\\u003C");
+	}
+
+	void set(unsigned c, const char *sequence)
+	{
+		lengths[c] = (uint8_t) strlen(sequence);
+		memcpy(sequences[c], sequence, lengths[c]);
+	}
+};
+
+const JsonEscapes jsonEscapes;
+
+// the longest output of a byte of input, "\u001F"
+const size_t maxJsonEscapeLength = 6;
+
+inline bool is_continuation(uint8_t c)
+{
+	return (c & 0xc0) == 0x80;
+}
+
+// the characters base::IsValidCharacter() rejects, besides the surrogates
+inline bool is_noncharacter(uint32_t c)
+{
+	return (c >= 0xfdd0 && c <= 0xfdef) || (c & 0xfffe) == 0xfffe;
+}
+
+// Write the character at `p`, which isn't printable ASCII, and return the
+// number of bytes read. An ill-formed sequence is replaced as a whole, up
+// to the first byte which can't continue it, like the WHATWG decoder does.
+size_t write_json_char(const uint8_t *p, size_t n, char *&o)
+{
+	const uint8_t c = p[0];
+	if (c < 0x80) {
+		memcpy(o, jsonEscapes.sequences[c], maxJsonEscapeLength);
+		o += jsonEscapes.lengths[c];
+		return 1;
+	}
+
+	// the length of the sequence and the range of its second byte, which
+	// excludes the overlong forms, the surrogates and what is past U+10FFFF
+	size_t length = 0;
+	uint8_t low = 0x80;
+	uint8_t high = 0xbf;
+	if (c >= 0xc2 && c <= 0xdf) {
+		length = 2;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		length = 3;
+		low = c == 0xe0 ? 0xa0 : 0x80;
+		high = c == 0xed ? 0x9f : 0xbf;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		length = 4;
+		low = c == 0xf0 ? 0x90 : 0x80;
+		high = c == 0xf4 ? 0x8f : 0xbf;
+	}
+
+	size_t valid = 1;
+	if (length != 0 && n > 1 && p[1] >= low && p[1] <= high) {
+		valid = 2;
+		while (valid < length && valid < n && is_continuation(p[valid])) {
+			valid++;
+		}
+	}
+	uint32_t code = 0xfffd;
+	if (valid == length) {
+		code = c & (0x7f >> length);
+		for (size_t i = 1; i < length; ++i) {
+			code = code << 6 | (p[i] & 0x3f);
+		}
+	}
+
+	if (code == 0x2028 || code == 0x2029) {
+		memcpy(o, code == 0x2028 ? "\\u2028" : "\\u2029", 6);
+		o += 6;
+	} else if (code == 0xfffd || is_noncharacter(code)) {
+		memcpy(o, "\xef\xbf\xbd", 3);
+		o += 3;
+	} else {
+		memcpy(o, p, length);
+		o += length;
+	}
+	return valid;
+}
+
+// write the escaped text, for which there must be room for
+// maxJsonEscapeLength bytes per byte, and return the end of the output
+char *copy_json_escaped_scalar(const uint8_t *p, size_t n, char *o)
+{
+	size_t i = 0;
+	while (i < n) {
+		const uint8_t c = p[i];
+		if (c >= 0x20 && c < 0x80 && jsonEscapes.lengths[c] == 0) {
+			*o++ = (char) c;
+			i++;
+		} else {
+			i += write_json_char(p + i, n - i, o);
+		}
+	}
+	return o;
+}
+
+#if defined(__SSE2__)
+
+char *copy_json_escaped(const uint8_t *p, size_t n, char *o)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i less = _mm_set1_epi8('<');
+	size_t i = 0;
+	while (i + 16 <= n) {
+		const __m128i in = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(p + i));
+		// the signed comparison takes the bytes above 0x7f too
+		const __m128i special = _mm_or_si128(
+				_mm_or_si128(_mm_cmplt_epi8(in, space),
+							 _mm_cmpeq_epi8(in, quote)),
+				_mm_or_si128(_mm_cmpeq_epi8(in, backslash),
+							 _mm_cmpeq_epi8(in, less)));
+		const unsigned mask = _mm_movemask_epi8(special);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(o), in);
+		if (mask == 0) {
+			o += 16;
+			i += 16;
+			continue;
+		}
+		// keep the bytes before the first special one, then write it
+		const unsigned plain = __builtin_ctz(mask);
+		o += plain;
+		i += plain;
+		i += write_json_char(p + i, n - i, o);
+	}
+	return copy_json_escaped_scalar(p + i, n - i, o);
+}
+
+#else
+
+char *copy_json_escaped(const uint8_t *p, size_t n, char *o)
+{
+	return copy_json_escaped_scalar(p, n, o);
+}
+
+#endif // __SSE2__
+
+} // namespace
+
+void append_csv_field(output::OutputBuffer &out, std::string_view value)
+{
+	const CsvScan scan = scan_csv(value.data(), value.size());
+	if (!scan.needsQuotes) {
+		out.append(value);
+		return;
+	}
+
+	// the exact size is known, the field is written in place in one go
+	const size_t size = value.size() + scan.quotes + 2;
+	char *o = out.reserve(size);
+	*o++ = '"';
+	o = copy_doubling_quotes(value.data(), value.size(), o);
+	*o = '"';
+	out.advance(size);
+}
+
+void append_json_string(output::OutputBuffer &out, std::string_view value)
+{
+	// in blocks, so that the room reserved for the worst case stays small
+	const size_t blockSize = 16 * 1024;
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(value.data());
+	size_t n = value.size();
+	out.append('"');
+	while (n != 0) {
+		size_t size = std::min(n, blockSize);
+		// don't cut a character in two
+		if (size < n) {
+			while (size > blockSize - 4 && is_continuation(p[size])) {
+				size--;
+			}
+		}
+		char *o = out.reserve(maxJsonEscapeLength * size + 16);
+		out.advance(copy_json_escaped(p, size, o) - o);
+		p += size;
+		n -= size;
+	}
+	out.append('"');
+}
+
+} /* namespace escape */
@@ -0,0 +1,34 @@
+/*
+ * text_escape.h - escape the record fields for the output formats
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_TEXT_ESCAPE_H_
+#define SRC_TEXT_ESCAPE_H_
+
+#include "output_buffer.h"
+
+#include <string_view>
+
+namespace escape {
+
+// Append a CSV field (RFC 4180): as it is, or between quotes with the
+// quotes doubled when it contains a comma, a quote or a line break. Linear
+// in the length of the field, the characters are looked for 16 at a time.
+void append_csv_field(output::OutputBuffer &out, std::string_view value);
+
+// Append a JSON string between quotes, escaped like base::EscapeJSONString()
+// of Chromium does: the quotes, the backslashes and the control characters,
+// '<' so that the output can't close a script element, and the line and
+// paragraph separators U+2028 and U+2029. The rest of the UTF-8 is written
+// as it is, but each ill-formed sequence and each noncharacter becomes
+// U+FFFD. The text is copied 16 bytes at a time up to the next byte which
+// isn't printable ASCII.
+void append_json_string(output::OutputBuffer &out, std::string_view value);
+
+} /* namespace escape */
+
+#endif /* SRC_TEXT_ESCAPE_H_ */
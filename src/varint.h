@@ -0,0 +1,112 @@
+/*
+ * varint.h - bounds checked decoding of base 128 variable length integers
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: Robert
+ *   Copyright: Use of this source code is governed by a BSD 2-Clause license
+ *              that can be found in the LICENSE file.
+ */
+#ifndef SRC_VARINT_H_
+#define SRC_VARINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace varint {
+
+// longest encoding of a 64 bit value
+constexpr size_t maxLength = 10;
+
+namespace detail {
+
+// masks keeping the first n bytes of a little endian word
+constexpr uint64_t lengthMasks[9] = {
+	0,
+	0x00000000000000ffull,
+	0x000000000000ffffull,
+	0x0000000000ffffffull,
+	0x00000000ffffffffull,
+	0x000000ffffffffffull,
+	0x0000ffffffffffffull,
+	0x00ffffffffffffffull,
+	0xffffffffffffffffull
+};
+
+inline bool decode_slow(const uint8_t **p, const uint8_t *const pend,
+						uint64_t *value)
+{
+	const uint8_t *i = *p;
+	uint64_t result = 0;
+	for (unsigned shift = 0; shift < 7 * maxLength; shift += 7) {
+		if (i == pend) {
+			return false;
+		}
+		const uint64_t byte = *i++;
+		if (shift == 63 && byte > 1) {
+			// doesn't fit in 64 bits
+			return false;
+		}
+		result |= (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			*value = result;
+			*p = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace detail
+
+// Decode the varint at *p, never reading at or past pend, and advance *p
+// past it. Returns false, leaving *p unchanged, when the varint is truncated
+// or longer than 64 bits.
+inline bool decode(const uint8_t **p, const uint8_t *const pend,
+				   uint64_t *value)
+{
+	const uint8_t *i = *p;
+	const size_t available = pend - i;
+
+	// string and array lengths mostly fit in 1 or 2 bytes
+	if (available >= 1 && (i[0] & 0x80) == 0) {
+		*value = i[0];
+		*p = i + 1;
+		return true;
+	}
+	if (available >= 2 && (i[1] & 0x80) == 0) {
+		*value = (i[0] & 0x7f) | (uint64_t(i[1]) << 7);
+		*p = i + 2;
+		return true;
+	}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// Up to 8 bytes at once: the first byte without the continuation bit
+	// gives the length, then the 7 bit groups are folded together.
+	if (available >= 8) {
+		uint64_t word;
+		memcpy(&word, i, sizeof(word));
+		const uint64_t stops = ~word & 0x8080808080808080ull;
+		if (stops) {
+			const size_t length = (__builtin_ctzll(stops) + 1) / 8;
+			uint64_t x = word & detail::lengthMasks[length] &
+					0x7f7f7f7f7f7f7f7full;
+			x = ((x & 0x7f007f007f007f00ull) >> 1) |
+					(x & 0x007f007f007f007full);
+			x = ((x & 0x3fff00003fff0000ull) >> 2) |
+					(x & 0x00003fff00003fffull);
+			x = ((x & 0x0fffffff00000000ull) >> 4) |
+					(x & 0x000000000fffffffull);
+			*value = x;
+			*p = i + length;
+			return true;
+		}
+	}
+#endif
+
+	return detail::decode_slow(p, pend, value);
+}
+
+} /* namespace varint */
+
+#endif /* SRC_VARINT_H_ */